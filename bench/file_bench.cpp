@@ -0,0 +1,90 @@
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <string>
+#include "logger.h"
+#include "File.h"
+
+/**
+ * 文件通道写入性能对比: std::ofstream逐条写入、LogFileChannel(writev)、LogMmapFileChannel(内存映射)、LogUringFileChannel(io_uring)
+ * 每种方式各自使用一个异步写线程的日志器，统计调用线程耗时与全部落盘(通道关闭)的总耗时
+ * 用法: ./bin/file_bench [条数] [目录]，目录默认为/tmp/mylogger_bench/
+ */
+
+// 旧的写入方式，每条日志经ostream格式化后写入std::ofstream
+class OfstreamChannel : public LogChannel
+{
+public:
+    OfstreamChannel(const std::string &path) : LogChannel("OfstreamChannel", LTrace), _fstream(path, std::ios::out | std::ios::app) {}
+
+    void write(const Logger &logger, const LogContextPtr &ctx) override
+    {
+        format(logger, _fstream, ctx, false);
+    }
+
+private:
+    std::ofstream _fstream;
+};
+
+struct BenchResult
+{
+    double produce_ns;
+    double total_ns;
+};
+
+static BenchResult runBench(std::shared_ptr<LogChannel> channel, size_t count)
+{
+    BenchResult result;
+    auto logger = std::make_shared<Logger>("bench");
+    logger->add_channel(channel);
+    logger->set_writer(std::make_shared<LogAsyncWriter>(64 * 1024));
+    std::string payload(80, 'x');
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < count; ++i)
+    {
+        static constexpr auto s_site = LOG_CALL_SITE("");
+        LogCapturer(*logger, s_site, LInfo) << "bench record " << i << " " << payload;
+    }
+    auto produced = std::chrono::steady_clock::now();
+    // 析构写线程会等待队列写完，析构通道会等待所有写请求完成
+    logger->set_writer(nullptr);
+    logger->del(channel->name());
+    channel.reset();
+    logger.reset();
+    auto done = std::chrono::steady_clock::now();
+    result.produce_ns = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(produced - start).count() / count;
+    result.total_ns = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(done - start).count() / count;
+    return result;
+}
+
+static void report(const char *name, const BenchResult &result)
+{
+    printf("%-22s produce %8.1f ns/op, total %8.1f ns/op, %8.0f op/s\n", name, result.produce_ns, result.total_ns, 1e9 / result.total_ns);
+}
+
+int main(int argc, char *argv[])
+{
+    local_time_init();
+    size_t count = argc > 1 ? strtoul(argv[1], nullptr, 10) : 1000000;
+    std::string dir = argc > 2 ? argv[2] : "/tmp/mylogger_bench/";
+    if (dir.back() != '/')
+    {
+        dir.push_back('/');
+    }
+    File::delete_file(dir.data());
+    File::create_path((dir + "ofstream/").data(), 0777);
+
+    report("ofstream", runBench(std::make_shared<OfstreamChannel>(dir + "ofstream/bench.log"), count));
+    report("LogFileChannel", runBench(std::make_shared<LogFileChannel>("FileChannel", dir + "writev/"), count));
+    report("LogMmapFileChannel", runBench(std::make_shared<LogMmapFileChannel>("MmapFileChannel", dir + "mmap/"), count));
+
+    auto uring = std::make_shared<LogUringFileChannel>("UringFileChannel", dir + "uring/");
+    if (!uring->uringEnabled())
+    {
+        printf("io_uring unavailable, LogUringFileChannel falls back to writev\n");
+    }
+    report("LogUringFileChannel", runBench(std::move(uring), count));
+
+    File::delete_file(dir.data());
+    return 0;
+}
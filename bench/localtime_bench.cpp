@@ -0,0 +1,80 @@
+#include <cstdio>
+#include <cstring>
+#include <chrono>
+#include <random>
+#include <vector>
+#include "tools.h"
+
+/**
+ * no_locks_localtime与localtime_r的对比测试
+ * 先校验两者在切换表范围内逐小时结果一致，再分别测量顺序时间戳与随机时间戳的耗时
+ * 可通过环境变量TZ指定时区，例如 TZ=America/New_York ./bin/localtime_bench
+ */
+
+static bool sameTm(const struct tm &a, const struct tm &b)
+{
+    return a.tm_year == b.tm_year && a.tm_mon == b.tm_mon && a.tm_mday == b.tm_mday &&
+           a.tm_hour == b.tm_hour && a.tm_min == b.tm_min && a.tm_sec == b.tm_sec &&
+           a.tm_wday == b.tm_wday && a.tm_yday == b.tm_yday && a.tm_isdst == b.tm_isdst &&
+           a.tm_gmtoff == b.tm_gmtoff;
+}
+
+template <typename FUNC>
+static double benchNs(const std::vector<time_t> &input, FUNC &&func)
+{
+    struct tm tm;
+    long sum = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (auto t : input)
+    {
+        func(&tm, t);
+        sum += tm.tm_sec;
+    }
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    // 防止循环被优化掉
+    if (sum == -1)
+    {
+        printf("%ld\n", sum);
+    }
+    return (double)ns / input.size();
+}
+
+int main(int argc, char *argv[])
+{
+    local_time_init();
+    time_t now = time(nullptr);
+
+    size_t mismatch = 0;
+    for (time_t t = now - 366 * 24 * 3600; t < now + 5 * 366 * 24 * 3600; t += 3600 + 7)
+    {
+        struct tm a, b;
+        no_locks_localtime(&a, t);
+        localtime_r(&t, &b);
+        if (!sameTm(a, b))
+        {
+            if (++mismatch < 10)
+            {
+                printf("mismatch at %ld: %02d:%02d isdst=%d vs %02d:%02d isdst=%d\n", (long)t,
+                       a.tm_hour, a.tm_min, a.tm_isdst, b.tm_hour, b.tm_min, b.tm_isdst);
+            }
+        }
+    }
+
+    const size_t count = argc > 1 ? atoi(argv[1]) : 2000000;
+    std::vector<time_t> sequential(count), random(count);
+    std::mt19937_64 rng(1);
+    for (size_t i = 0; i < count; ++i)
+    {
+        sequential[i] = now + i / 1000;
+        random[i] = now - 366 * 24 * 3600 + (time_t)(rng() % (6 * 366 * 24 * 3600ULL));
+    }
+
+    auto localtime_func = [](struct tm *tm, time_t t)
+    { localtime_r(&t, tm); };
+    printf("mismatch: %zu\n", mismatch);
+    printf("sequential no_locks_localtime: %.1f ns/op\n", benchNs(sequential, no_locks_localtime));
+    printf("sequential localtime_r:        %.1f ns/op\n", benchNs(sequential, localtime_func));
+    printf("random     no_locks_localtime: %.1f ns/op\n", benchNs(random, no_locks_localtime));
+    printf("random     localtime_r:        %.1f ns/op\n", benchNs(random, localtime_func));
+    return mismatch ? 1 : 0;
+}
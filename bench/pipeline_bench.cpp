@@ -0,0 +1,360 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <functional>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include <sys/time.h>
+#if defined(__linux__)
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+#include "logger.h"
+#include "File.h"
+
+/**
+ * 日志流水线各阶段的微基准测试，结果以JSON输出到标准输出，便于不同版本之间对比
+ * 每项给出ns/op、每次操作的堆分配次数，以及性能计数器可用时的每次操作指令数
+ * 用法: ./bin/pipeline_bench [名称过滤] [迭代倍数]，例如 ./bin/pipeline_bench stream 10
+ */
+
+#if defined(__GLIBC__)
+// 替换malloc系列函数统计进程内的堆分配次数，operator new也经由malloc
+extern "C"
+{
+    void *__libc_malloc(size_t size);
+    void *__libc_calloc(size_t count, size_t size);
+    void *__libc_realloc(void *ptr, size_t size);
+}
+
+static std::atomic<uint64_t> s_alloc_count(0);
+
+extern "C" void *malloc(size_t size)
+{
+    s_alloc_count.fetch_add(1, std::memory_order_relaxed);
+    return __libc_malloc(size);
+}
+
+extern "C" void *calloc(size_t count, size_t size)
+{
+    s_alloc_count.fetch_add(1, std::memory_order_relaxed);
+    return __libc_calloc(count, size);
+}
+
+extern "C" void *realloc(void *ptr, size_t size)
+{
+    s_alloc_count.fetch_add(1, std::memory_order_relaxed);
+    return __libc_realloc(ptr, size);
+}
+
+static bool allocCountAvailable() { return true; }
+static uint64_t allocCount() { return s_alloc_count.load(std::memory_order_relaxed); }
+#else
+static bool allocCountAvailable() { return false; }
+static uint64_t allocCount() { return 0; }
+#endif
+
+// 当前线程用户态执行的指令数，性能计数器不可用(如容器内)时返回无效
+class InstructionCounter
+{
+public:
+    InstructionCounter()
+    {
+#if defined(__linux__)
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.size = sizeof(attr);
+        attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        _fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+#endif
+    }
+
+    ~InstructionCounter()
+    {
+        if (_fd != -1)
+        {
+            close(_fd);
+        }
+    }
+
+    bool valid() const { return _fd != -1; }
+
+    uint64_t read() const
+    {
+        uint64_t value = 0;
+        if (_fd == -1 || ::read(_fd, &value, sizeof(value)) != sizeof(value))
+        {
+            return 0;
+        }
+        return value;
+    }
+
+private:
+    int _fd = -1;
+};
+
+// 丢弃日志的通道，用于测量通道之前的开销，并暴露format
+class NullChannel : public LogChannel
+{
+public:
+    NullChannel() : LogChannel("NullChannel", LTrace) {}
+
+    void write(const Logger &, const LogContextPtr &) override {}
+
+    void formatTo(const Logger &logger, std::ostream &ost, const LogContextPtr &ctx)
+    {
+        format(logger, ost, ctx, false);
+    }
+};
+
+// 丢弃所有写入的输出流
+class NullBuf : public std::streambuf
+{
+protected:
+    int overflow(int c) override { return c; }
+    std::streamsize xsputn(const char *, std::streamsize n) override { return n; }
+};
+
+// 只统计start与stop之间的耗时、分配与指令数，准备数据与清理不计入
+class Measure
+{
+public:
+    explicit Measure(const InstructionCounter &counter) : _counter(counter) {}
+
+    void start()
+    {
+        _alloc_start = allocCount();
+        _instr_start = _counter.read();
+        _start = std::chrono::steady_clock::now();
+    }
+
+    void stop()
+    {
+        ns += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - _start).count();
+        instructions += _counter.read() - _instr_start;
+        allocs += allocCount() - _alloc_start;
+    }
+
+    uint64_t ns = 0;
+    uint64_t allocs = 0;
+    uint64_t instructions = 0;
+
+private:
+    const InstructionCounter &_counter;
+    std::chrono::steady_clock::time_point _start;
+    uint64_t _alloc_start = 0;
+    uint64_t _instr_start = 0;
+};
+
+struct BenchCase
+{
+    std::string name;
+    size_t iterations;
+    // 执行iterations次操作，返回实际完成的操作数
+    std::function<size_t(size_t, Measure &)> run;
+};
+
+static const char *s_payload = "request finished, status ok, user 10086, cost 12.5ms";
+
+static std::vector<LogContextPtr> makeRecords(size_t count)
+{
+    static constexpr auto s_site = LOG_CALL_SITE("");
+    std::vector<LogContextPtr> records;
+    records.reserve(count);
+    for (size_t i = 0; i < count; ++i)
+    {
+        auto ctx = LogContext::create(s_site, LInfo);
+        (*ctx) << s_payload << " seq " << i;
+        records.emplace_back(std::move(ctx));
+    }
+    return records;
+}
+
+// 每条日志写入若干个同类型的值，按写入次数计算单次operator<<的开销
+template <typename T>
+static size_t streamValues(size_t iterations, Measure &measure, const T &value)
+{
+    static constexpr auto s_site = LOG_CALL_SITE("");
+    static const size_t s_per_record = 64;
+    size_t done = 0;
+    measure.start();
+    while (done < iterations)
+    {
+        auto ctx = LogContext::create(s_site, LInfo);
+        for (size_t i = 0; i < s_per_record; ++i)
+        {
+            (*ctx) << value;
+        }
+        done += s_per_record;
+    }
+    measure.stop();
+    return done;
+}
+
+static std::vector<BenchCase> makeCases(size_t scale, const std::string &dir)
+{
+    std::vector<BenchCase> cases;
+
+    // 构造LogCapturer并提交，没有通道时在Logger::write入口返回
+    cases.push_back({"capture_empty", 2000000 * scale, [](size_t n, Measure &measure)
+                     {
+                         static constexpr auto s_site = LOG_CALL_SITE("");
+                         Logger logger("bench");
+                         measure.start();
+                         for (size_t i = 0; i < n; ++i)
+                         {
+                             LogCapturer(logger, s_site, LInfo);
+                         }
+                         measure.stop();
+                         return n;
+                     }});
+    cases.push_back({"stream_int", 4000000 * scale, [](size_t n, Measure &measure)
+                     { return streamValues(n, measure, 1234567); }});
+    cases.push_back({"stream_double", 2000000 * scale, [](size_t n, Measure &measure)
+                     { return streamValues(n, measure, 3.14159265); }});
+    cases.push_back({"stream_cstr", 4000000 * scale, [](size_t n, Measure &measure)
+                     { return streamValues(n, measure, "literal"); }});
+    cases.push_back({"stream_string", 4000000 * scale, [](size_t n, Measure &measure)
+                     { return streamValues(n, measure, std::string("std::string value")); }});
+    cases.push_back({"print_time", 4000000 * scale, [](size_t n, Measure &measure)
+                     {
+                         struct timeval tv;
+                         gettimeofday(&tv, nullptr);
+                         char buf[64];
+                         size_t sum = 0;
+                         measure.start();
+                         for (size_t i = 0; i < n; ++i)
+                         {
+                             tv.tv_usec = (tv.tv_usec + 997) % 1000000;
+                             sum += LogChannel::printTime(tv, buf, sizeof(buf), 3);
+                         }
+                         measure.stop();
+                         return sum ? n : 0;
+                     }});
+    cases.push_back({"no_locks_localtime", 4000000 * scale, [](size_t n, Measure &measure)
+                     {
+                         auto t = time(nullptr);
+                         struct tm tm;
+                         int sum = 0;
+                         measure.start();
+                         for (size_t i = 0; i < n; ++i)
+                         {
+                             no_locks_localtime(&tm, t + (time_t)i);
+                             sum += tm.tm_sec;
+                         }
+                         measure.stop();
+                         return sum >= 0 ? n : 0;
+                     }});
+    // 每条日志只格式化一次，不命中渲染缓存
+    cases.push_back({"channel_format", 200000 * scale, [](size_t n, Measure &measure)
+                     {
+                         Logger logger("bench");
+                         NullChannel channel;
+                         NullBuf buf;
+                         std::ostream ost(&buf);
+                         auto records = makeRecords(n);
+                         measure.start();
+                         for (auto &ctx : records)
+                         {
+                             channel.formatTo(logger, ost, ctx);
+                         }
+                         measure.stop();
+                         return n;
+                     }});
+    // 调用线程构造日志并放入异步写线程队列的开销，不含写线程处理剩余日志的时间
+    cases.push_back({"async_enqueue", 1000000 * scale, [](size_t n, Measure &measure)
+                     {
+                         static constexpr auto s_site = LOG_CALL_SITE("");
+                         Logger logger("bench");
+                         logger.add_channel(std::make_shared<NullChannel>());
+                         logger.set_writer(std::make_shared<LogAsyncWriter>(64 * 1024));
+                         measure.start();
+                         for (size_t i = 0; i < n; ++i)
+                         {
+                             LogCapturer(logger, s_site, LInfo) << s_payload << " seq " << i;
+                         }
+                         measure.stop();
+                         return n;
+                     }});
+    // 文件通道写入预先构造的日志，包含最后一次写出
+    cases.push_back({"file_write", 500000 * scale, [dir](size_t n, Measure &measure)
+                     {
+                         Logger logger("bench");
+                         auto records = makeRecords(n);
+                         {
+                             LogFileChannel channel("bench", dir, LTrace);
+                             measure.start();
+                             for (auto &ctx : records)
+                             {
+                                 channel.write(logger, ctx);
+                             }
+                             channel.flush();
+                             measure.stop();
+                         }
+                         File::delete_file(dir.data());
+                         return n;
+                     }});
+    return cases;
+}
+
+static void printNumber(const char *key, double value, bool valid, bool last = false)
+{
+    if (valid)
+    {
+        printf("      \"%s\": %.3f%s\n", key, value, last ? "" : ",");
+    }
+    else
+    {
+        printf("      \"%s\": null%s\n", key, last ? "" : ",");
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    std::string filter = argc > 1 ? argv[1] : "";
+    size_t scale = argc > 2 ? std::max(1, atoi(argv[2])) : 1;
+    std::string dir = "/tmp/mylogger_pipeline_bench/";
+    local_time_init();
+
+    InstructionCounter counter;
+    printf("{\n");
+    printf("  \"context\": {\n");
+    printf("    \"compiler\": \"%s\",\n", __VERSION__);
+    printf("    \"time\": %ld,\n", (long)time(nullptr));
+    printf("    \"perf_counters\": %s,\n", counter.valid() ? "true" : "false");
+    printf("    \"alloc_counter\": %s\n", allocCountAvailable() ? "true" : "false");
+    printf("  },\n");
+    printf("  \"benchmarks\": [");
+    bool first = true;
+    for (auto &item : makeCases(scale, dir))
+    {
+        if (!filter.empty() && item.name.find(filter) == std::string::npos)
+        {
+            continue;
+        }
+        // 预热一轮，填充对象池与缓存
+        Measure warmup(counter);
+        item.run(item.iterations / 10, warmup);
+
+        Measure measure(counter);
+        auto ops = std::max<size_t>(item.run(item.iterations, measure), 1);
+
+        printf("%s\n    {\n", first ? "" : ",");
+        first = false;
+        printf("      \"name\": \"%s\",\n", item.name.data());
+        printf("      \"iterations\": %zu,\n", ops);
+        printNumber("ns_per_op", (double)measure.ns / ops, true);
+        printNumber("allocs_per_op", (double)measure.allocs / ops, allocCountAvailable());
+        printNumber("instructions_per_op", (double)measure.instructions / ops, counter.valid(), true);
+        printf("    }");
+        fflush(stdout);
+    }
+    printf("\n  ]\n}\n");
+    return 0;
+}
@@ -0,0 +1,494 @@
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include "logger.h"
+#include "File.h"
+
+/**
+ * 多生产者端到端压力测试，模拟线上的日志负载
+ * N个线程按指定速率与消息长度分布打印日志，记录每次日志调用的延迟分布(p50/p99/p99.9/max)、
+ * 全部日志落盘的端到端耗时、持续吞吐、异步队列深度随时间的变化与峰值RSS，结果以JSON输出
+ * 用法: ./bin/stress_bench [key=value ...]
+ *   threads=1,8,64      生产者线程数，逗号分隔时依次运行多轮
+ *   mode=async          async(异步写文件)、sync(同步写文件)、file+console(异步写文件与控制台)
+ *   rate=0              每个线程每秒的日志条数，0表示不限速
+ *   duration=5          每轮打印日志的秒数
+ *   size=128            消息长度: 固定值128、均匀分布16-512或指数分布exp:200
+ *   queue=16384         异步队列容量
+ *   policy=block        队列满时的策略: block、drop_newest、drop_oldest
+ *   dir=/tmp/mylogger_stress/  日志目录，每轮结束后删除
+ *   out=                结果输出文件，默认标准输出；file+console模式下日志也写到标准输出，应指定该参数
+ */
+
+// 对数线性分桶的延迟直方图，每个2的幂区间分为64档，相对误差不超过1/64
+class LatencyHistogram
+{
+public:
+    LatencyHistogram() : _counts(s_bucket_count, 0) {}
+
+    void record(uint64_t ns)
+    {
+        ++_counts[bucketOf(ns)];
+        ++_total;
+        _sum += ns;
+        _max = std::max(_max, ns);
+    }
+
+    void merge(const LatencyHistogram &that)
+    {
+        for (size_t i = 0; i < s_bucket_count; ++i)
+        {
+            _counts[i] += that._counts[i];
+        }
+        _total += that._total;
+        _sum += that._sum;
+        _max = std::max(_max, that._max);
+    }
+
+    uint64_t total() const { return _total; }
+    uint64_t max() const { return _max; }
+    double mean() const { return _total ? (double)_sum / _total : 0; }
+
+    // 返回不小于该比例样本的最小档位上限
+    uint64_t percentile(double ratio) const
+    {
+        if (!_total)
+        {
+            return 0;
+        }
+        auto target = std::max<uint64_t>(1, (uint64_t)(ratio * _total + 0.5));
+        uint64_t count = 0;
+        for (size_t i = 0; i < s_bucket_count; ++i)
+        {
+            count += _counts[i];
+            if (count >= target)
+            {
+                return std::min(upperOf(i), _max);
+            }
+        }
+        return _max;
+    }
+
+private:
+    static const size_t s_sub_buckets = 64;
+    static const size_t s_bucket_count = s_sub_buckets * 59;
+
+    // 小于128的值一档一个；更大的值保留最高7位
+    static size_t bucketOf(uint64_t value)
+    {
+        if (value < 2 * s_sub_buckets)
+        {
+            return value;
+        }
+        int shift = 63 - __builtin_clzll(value) - 6;
+        return s_sub_buckets * (shift + 1) + ((value >> shift) - s_sub_buckets);
+    }
+
+    static uint64_t upperOf(size_t index)
+    {
+        if (index < 2 * s_sub_buckets)
+        {
+            return index;
+        }
+        int shift = (int)(index / s_sub_buckets) - 1;
+        uint64_t mantissa = s_sub_buckets + index % s_sub_buckets;
+        return ((mantissa + 1) << shift) - 1;
+    }
+
+private:
+    std::vector<uint64_t> _counts;
+    uint64_t _total = 0;
+    uint64_t _sum = 0;
+    uint64_t _max = 0;
+};
+
+struct Options
+{
+    std::vector<size_t> threads = {1, 8, 64};
+    std::string mode = "async";
+    double rate = 0;
+    double duration = 5;
+    std::string size = "128";
+    size_t queue = 16 * 1024;
+    std::string policy = "block";
+    std::string dir = "/tmp/mylogger_stress/";
+    std::string out;
+};
+
+// 按配置生成消息长度
+class SizeDistribution
+{
+public:
+    explicit SizeDistribution(const std::string &spec)
+    {
+        if (spec.compare(0, 4, "exp:") == 0)
+        {
+            _exp_mean = std::max(1.0, atof(spec.data() + 4));
+            _max = (size_t)(_exp_mean * 20);
+            return;
+        }
+        auto pos = spec.find('-');
+        _min = (size_t)atol(spec.data());
+        _max = pos == std::string::npos ? _min : (size_t)atol(spec.data() + pos + 1);
+        _max = std::max(_min, _max);
+    }
+
+    size_t max() const { return _max; }
+
+    size_t operator()(std::mt19937_64 &rng) const
+    {
+        if (_exp_mean > 0)
+        {
+            std::exponential_distribution<double> dist(1.0 / _exp_mean);
+            return std::min(_max, (size_t)dist(rng));
+        }
+        if (_min == _max)
+        {
+            return _min;
+        }
+        return std::uniform_int_distribution<size_t>(_min, _max)(rng);
+    }
+
+private:
+    size_t _min = 0;
+    size_t _max = 0;
+    double _exp_mean = 0;
+};
+
+struct ProducerResult
+{
+    LatencyHistogram call;
+    // 限速时从计划发送时刻算起的延迟，包含因前一次调用阻塞而推迟的时间
+    LatencyHistogram scheduled;
+    uint64_t bytes = 0;
+};
+
+struct QueueSample
+{
+    double ms;
+    size_t depth;
+    size_t bytes;
+};
+
+static uint64_t nowNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// 当前进程的峰值RSS(KB)
+static long peakRssKb()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    long peak = usage.ru_maxrss;
+    // getrusage的峰值不能重置，优先读取可重置的VmHWM
+    auto status = File::loadFile("/proc/self/status");
+    auto pos = status.find("VmHWM:");
+    if (pos != std::string::npos)
+    {
+        peak = atol(status.data() + pos + 6);
+    }
+    return peak;
+}
+
+static void resetPeakRss()
+{
+    int fd = open("/proc/self/clear_refs", O_WRONLY);
+    if (fd != -1)
+    {
+        if (write(fd, "5", 1) != 1)
+        {
+            // 内核不支持时峰值为进程启动以来的最大值
+        }
+        close(fd);
+    }
+}
+
+static void producer(Logger &logger, const Options &opt, size_t index, uint64_t start_ns, uint64_t end_ns, ProducerResult &result)
+{
+    static constexpr auto s_site = LOG_CALL_SITE("");
+    setThreadName(("producer " + std::to_string(index)).data());
+    SizeDistribution sizes(opt.size);
+    std::string payload(sizes.max(), 'x');
+    std::mt19937_64 rng(index * 7919 + 1);
+    uint64_t interval = opt.rate > 0 ? (uint64_t)(1e9 / opt.rate) : 0;
+    uint64_t next = start_ns;
+    // 所有线程同时开始
+    while (nowNs() < start_ns)
+    {
+        std::this_thread::yield();
+    }
+    for (uint64_t seq = 0;; ++seq)
+    {
+        auto now = nowNs();
+        if (interval)
+        {
+            next += interval;
+            if (next > now + 200 * 1000)
+            {
+                std::this_thread::sleep_for(std::chrono::nanoseconds(next - now - 100 * 1000));
+            }
+            while ((now = nowNs()) < next)
+            {
+            }
+        }
+        if (now >= end_ns)
+        {
+            break;
+        }
+        auto size = sizes(rng);
+        auto begin = nowNs();
+        LogCapturer(logger, s_site, LInfo) << "stress " << index << " " << seq << " " << std::string_view(payload.data(), size);
+        auto end = nowNs();
+        result.call.record(end - begin);
+        if (interval)
+        {
+            result.scheduled.record(end - next);
+        }
+        result.bytes += size;
+    }
+}
+
+static void printHistogram(FILE *fp, const char *name, const LatencyHistogram &hist, bool last)
+{
+    fprintf(fp, "      \"%s\": {\"count\": %llu, \"mean\": %.1f, \"p50\": %llu, \"p90\": %llu, \"p99\": %llu, \"p99.9\": %llu, \"p99.99\": %llu, \"max\": %llu}%s\n",
+            name, (unsigned long long)hist.total(), hist.mean(), (unsigned long long)hist.percentile(0.5),
+            (unsigned long long)hist.percentile(0.9), (unsigned long long)hist.percentile(0.99),
+            (unsigned long long)hist.percentile(0.999), (unsigned long long)hist.percentile(0.9999),
+            (unsigned long long)hist.max(), last ? "" : ",");
+}
+
+static void runOnce(FILE *fp, const Options &opt, size_t threads, bool first)
+{
+    File::delete_file(opt.dir.data());
+    resetPeakRss();
+
+    auto logger = std::make_shared<Logger>("stress");
+    logger->add_channel(std::make_shared<LogFileChannel>("file", opt.dir, LTrace));
+    if (opt.mode == "file+console")
+    {
+        logger->add_channel(std::make_shared<LogConsoleChannel>("console", LTrace));
+    }
+    std::shared_ptr<LogAsyncWriter> writer;
+    if (opt.mode != "sync")
+    {
+        writer = std::make_shared<LogAsyncWriter>(opt.queue);
+        if (opt.policy == "drop_newest")
+        {
+            writer->setOverflowPolicy(LogOverflowDropNewest);
+        }
+        else if (opt.policy == "drop_oldest")
+        {
+            writer->setOverflowPolicy(LogOverflowDropOldest);
+        }
+        logger->set_writer(writer);
+    }
+
+    std::vector<ProducerResult> results(threads);
+    std::vector<std::thread> producers;
+    auto start_ns = nowNs() + 10 * 1000 * 1000;
+    auto end_ns = start_ns + (uint64_t)(opt.duration * 1e9);
+    for (size_t i = 0; i < threads; ++i)
+    {
+        producers.emplace_back(producer, std::ref(*logger), std::cref(opt), i, start_ns, end_ns, std::ref(results[i]));
+    }
+
+    // 从生产开始每10ms采样一次队列深度，生产结束后停止
+    std::vector<QueueSample> samples;
+    std::atomic<bool> sampling{true};
+    std::thread sampler([&]()
+                        {
+        if (!writer)
+        {
+            return;
+        }
+        for (uint64_t now; (now = nowNs()) < start_ns;)
+        {
+            std::this_thread::sleep_for(std::chrono::nanoseconds(start_ns - now));
+        }
+        while (sampling)
+        {
+            samples.push_back({(nowNs() - start_ns) / 1e6, writer->queued(), writer->queuedBytes()});
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        } });
+    for (auto &thread : producers)
+    {
+        thread.join();
+    }
+    auto produced_ns = nowNs();
+    // 采样线程引用writer，必须在释放日志器之前结束
+    sampling = false;
+    sampler.join();
+    auto dropped = writer ? writer->dropped() : 0;
+
+    // 释放日志器时写线程处理完队列中的日志并关闭文件，之后同步到磁盘
+    writer.reset();
+    logger.reset();
+    File::scanDir(opt.dir, [](const std::string &path, bool is_dir)
+                  {
+        int fd = open(path.data(), O_RDONLY);
+        if (fd != -1)
+        {
+            fsync(fd);
+            close(fd);
+        }
+        return true; });
+    auto done_ns = nowNs();
+
+    uint64_t file_bytes = 0;
+    File::scanDir(opt.dir, [&](const std::string &path, bool is_dir)
+                  {
+        file_bytes += File::fileSize(path.data());
+        return true; });
+    File::delete_file(opt.dir.data());
+
+    ProducerResult total;
+    for (auto &result : results)
+    {
+        total.call.merge(result.call);
+        total.scheduled.merge(result.scheduled);
+        total.bytes += result.bytes;
+    }
+    size_t max_depth = 0;
+    double sum_depth = 0;
+    size_t max_bytes = 0;
+    for (auto &sample : samples)
+    {
+        max_depth = std::max(max_depth, sample.depth);
+        max_bytes = std::max(max_bytes, sample.bytes);
+        sum_depth += sample.depth;
+    }
+    auto start = (double)start_ns;
+    auto records = total.call.total();
+
+    fprintf(fp, "%s\n    {\n", first ? "" : ",");
+    fprintf(fp, "      \"threads\": %zu,\n", threads);
+    fprintf(fp, "      \"records\": %llu,\n", (unsigned long long)records);
+    fprintf(fp, "      \"dropped\": %llu,\n", (unsigned long long)dropped);
+    fprintf(fp, "      \"payload_bytes\": %llu,\n", (unsigned long long)total.bytes);
+    fprintf(fp, "      \"file_bytes\": %llu,\n", (unsigned long long)file_bytes);
+    fprintf(fp, "      \"produce_seconds\": %.3f,\n", (produced_ns - start) / 1e9);
+    fprintf(fp, "      \"drain_ms\": %.3f,\n", (done_ns - produced_ns) / 1e6);
+    fprintf(fp, "      \"end_to_end_seconds\": %.3f,\n", (done_ns - start) / 1e9);
+    fprintf(fp, "      \"records_per_second\": %.0f,\n", records / ((done_ns - start) / 1e9));
+    fprintf(fp, "      \"disk_mb_per_second\": %.2f,\n", file_bytes / ((done_ns - start) / 1e9) / (1024 * 1024));
+    fprintf(fp, "      \"peak_rss_kb\": %ld,\n", peakRssKb());
+    fprintf(fp, "      \"queue\": {\"max_depth\": %zu, \"avg_depth\": %.1f, \"max_bytes\": %zu, \"timeline\": [",
+            max_depth, samples.empty() ? 0 : sum_depth / samples.size(), max_bytes);
+    // 时间线最多保留100个点，每个点取区间内的最大深度
+    size_t step = std::max<size_t>(1, (samples.size() + 99) / 100);
+    for (size_t i = 0; i < samples.size(); i += step)
+    {
+        size_t depth = 0;
+        for (size_t j = i; j < std::min(samples.size(), i + step); ++j)
+        {
+            depth = std::max(depth, samples[j].depth);
+        }
+        fprintf(fp, "%s[%.0f, %zu]", i ? ", " : "", samples[i].ms, depth);
+    }
+    fprintf(fp, "]},\n");
+    printHistogram(fp, "call_latency_ns", total.call, opt.rate <= 0);
+    if (opt.rate > 0)
+    {
+        printHistogram(fp, "scheduled_latency_ns", total.scheduled, true);
+    }
+    fprintf(fp, "    }");
+    fflush(fp);
+}
+
+int main(int argc, char *argv[])
+{
+    Options opt;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        auto pos = arg.find('=');
+        if (pos == std::string::npos)
+        {
+            fprintf(stderr, "invalid argument: %s\n", argv[i]);
+            return 1;
+        }
+        auto key = arg.substr(0, pos);
+        auto value = arg.substr(pos + 1);
+        if (key == "threads")
+        {
+            opt.threads.clear();
+            for (auto &item : split(value, ","))
+            {
+                opt.threads.push_back(std::max(1, atoi(item.data())));
+            }
+        }
+        else if (key == "mode")
+        {
+            opt.mode = value;
+        }
+        else if (key == "rate")
+        {
+            opt.rate = atof(value.data());
+        }
+        else if (key == "duration")
+        {
+            opt.duration = atof(value.data());
+        }
+        else if (key == "size")
+        {
+            opt.size = value;
+        }
+        else if (key == "queue")
+        {
+            opt.queue = std::max(1, atoi(value.data()));
+        }
+        else if (key == "policy")
+        {
+            opt.policy = value;
+        }
+        else if (key == "dir")
+        {
+            opt.dir = value.empty() || value.back() == '/' ? value : value + "/";
+        }
+        else if (key == "out")
+        {
+            opt.out = value;
+        }
+        else
+        {
+            fprintf(stderr, "unknown option: %s\n", key.data());
+            return 1;
+        }
+    }
+    if (opt.mode != "async" && opt.mode != "sync" && opt.mode != "file+console")
+    {
+        fprintf(stderr, "unknown mode: %s\n", opt.mode.data());
+        return 1;
+    }
+
+    FILE *fp = opt.out.empty() ? stdout : fopen(opt.out.data(), "w");
+    if (!fp)
+    {
+        fprintf(stderr, "open %s failed: %s\n", opt.out.data(), strerror(errno));
+        return 1;
+    }
+    fprintf(fp, "{\n");
+    fprintf(fp, "  \"config\": {\"mode\": \"%s\", \"rate\": %.0f, \"duration\": %.1f, \"size\": \"%s\", \"queue\": %zu, \"policy\": \"%s\"},\n",
+            opt.mode.data(), opt.rate, opt.duration, opt.size.data(), opt.queue, opt.policy.data());
+    fprintf(fp, "  \"runs\": [");
+    for (size_t i = 0; i < opt.threads.size(); ++i)
+    {
+        runOnce(fp, opt, opt.threads[i], i == 0);
+    }
+    fprintf(fp, "\n  ]\n}\n");
+    if (fp != stdout)
+    {
+        fclose(fp);
+    }
+    return 0;
+}
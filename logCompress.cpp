@@ -0,0 +1,183 @@
+#include "logCompress.h"
+#include <cerrno>
+#include <cstdio>
+#include <ctime>
+#include <memory>
+#include <thread>
+#include <fcntl.h>
+#include <sys/stat.h>
+#if !defined(_WIN32)
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#endif
+// makefile探测到zlib不可链接时定义HAVE_ZLIB=0
+#if defined(__has_include) && (!defined(HAVE_ZLIB) || HAVE_ZLIB)
+#if __has_include(<zlib.h>)
+#define ENABLE_ZLIB
+#include <zlib.h>
+#endif
+#endif
+
+LogCompressor &LogCompressor::Instance()
+{
+    // 压缩线程在进程退出时可能仍在运行，对象不析构
+    static LogCompressor *s_instance = new LogCompressor;
+    return *s_instance;
+}
+
+bool LogCompressor::available()
+{
+#if defined(ENABLE_ZLIB)
+    return true;
+#else
+    return false;
+#endif
+}
+
+void LogCompressor::setMaxThreads(size_t count)
+{
+    std::lock_guard<std::mutex> lck(_mtx);
+    _max_threads = count > 1 ? count : 1;
+}
+
+void LogCompressor::setLevel(int level)
+{
+    _level = std::max(1, std::min(level, 9));
+}
+
+LogCompressor::Result LogCompressor::total() const
+{
+    std::lock_guard<std::mutex> lck(_mtx);
+    return _total;
+}
+
+void LogCompressor::compress(const std::string &path, onResult cb)
+{
+    if (!available())
+    {
+        return;
+    }
+    std::lock_guard<std::mutex> lck(_mtx);
+    _tasks.push_back({path, std::move(cb)});
+    if (_idle_threads)
+    {
+        _cond.notify_one();
+    }
+    else if (_threads < _max_threads)
+    {
+        // 按需创建线程，空闲线程不退出
+        ++_threads;
+        std::thread(&LogCompressor::run, this).detach();
+    }
+}
+
+void LogCompressor::run()
+{
+    setThreadName("log compress");
+#if defined(__linux__)
+    // linux下nice值按线程生效，压缩线程让出CPU给业务线程
+    setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), 19);
+#endif
+    std::unique_lock<std::mutex> lck(_mtx);
+    for (;;)
+    {
+        if (_tasks.empty())
+        {
+            ++_idle_threads;
+            _cond.wait(lck, [this]()
+                       { return !_tasks.empty(); });
+            --_idle_threads;
+        }
+        auto task = std::move(_tasks.front());
+        _tasks.pop_front();
+        lck.unlock();
+
+        auto result = compressFile(task.path);
+        if (task.cb)
+        {
+            task.cb(result);
+        }
+
+        lck.lock();
+        if (result.success)
+        {
+            _total.input_bytes += result.input_bytes;
+            _total.output_bytes += result.output_bytes;
+            _total.cpu_us += result.cpu_us;
+        }
+    }
+}
+
+#if !defined(_WIN32)
+static uint64_t threadCpuMicrosecond()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+#endif
+
+LogCompressor::Result LogCompressor::compressFile(const std::string &path)
+{
+    Result result;
+    result.path = path;
+#if defined(ENABLE_ZLIB) && !defined(_WIN32)
+    auto start = threadCpuMicrosecond();
+    int fd = ::open(path.data(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+    {
+        return result;
+    }
+    // 先写临时文件，压缩完成后再改名，避免留下不完整的.gz
+    auto gz_path = path + ".gz";
+    auto tmp_path = gz_path + ".tmp";
+    char mode[] = {'w', 'b', (char)('0' + _level.load()), '\0'};
+    auto gz = gzopen(tmp_path.data(), mode);
+    if (!gz)
+    {
+        ::close(fd);
+        return result;
+    }
+    gzbuffer(gz, 128 * 1024);
+    std::unique_ptr<char[]> buf(new char[256 * 1024]);
+    bool ok = true;
+    for (;;)
+    {
+        auto n = ::read(fd, buf.get(), 256 * 1024);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            ok = n == 0;
+            break;
+        }
+        if (gzwrite(gz, buf.get(), (unsigned)n) != n)
+        {
+            ok = false;
+            break;
+        }
+        result.input_bytes += n;
+    }
+    ::close(fd);
+    ok = gzclose(gz) == Z_OK && ok;
+    struct stat st;
+    if (!ok || stat(tmp_path.data(), &st) != 0 || rename(tmp_path.data(), gz_path.data()) != 0)
+    {
+        unlink(tmp_path.data());
+        return result;
+    }
+    result.output_bytes = st.st_size;
+    if (unlink(path.data()) != 0 && errno == ENOENT)
+    {
+        // 压缩期间原文件已被清理，压缩结果也不应保留
+        unlink(gz_path.data());
+        return result;
+    }
+    result.cpu_us = threadCpuMicrosecond() - start;
+    result.success = true;
+#endif
+    return result;
+}
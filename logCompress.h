@@ -0,0 +1,83 @@
+#ifndef LOG_COMPRESS_H
+#define LOG_COMPRESS_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include "tools.h"
+
+/**
+ * 日志切片的后台压缩器，把xxx.log压缩为xxx.log.gz后删除原文件
+ * 压缩在低优先级的后台线程中进行，线程数有上限，永远不会占用日志写线程
+ * 进程内所有文件通道共享同一个压缩器
+ */
+class LogCompressor : public noncopyable
+{
+public:
+    struct Result
+    {
+        std::string path;
+        bool success = false;
+        // 压缩前后字节数
+        size_t input_bytes = 0;
+        size_t output_bytes = 0;
+        // 压缩线程消耗的CPU时间
+        uint64_t cpu_us = 0;
+    };
+    using onResult = std::function<void(const Result &result)>;
+
+    static LogCompressor &Instance();
+
+    /**
+     * 是否编译了压缩支持
+     */
+    static bool available();
+
+    /**
+     * 设置最大并行压缩线程数，默认1
+     */
+    void setMaxThreads(size_t count);
+
+    /**
+     * 设置gzip压缩级别，1~9，默认6
+     */
+    void setLevel(int level);
+
+    /**
+     * 提交压缩任务，可在任意线程调用
+     * @param path 待压缩文件
+     * @param cb 压缩完成后在压缩线程中回调
+     */
+    void compress(const std::string &path, onResult cb);
+
+    /**
+     * 累计压缩统计
+     */
+    Result total() const;
+
+private:
+    LogCompressor() = default;
+    void run();
+    Result compressFile(const std::string &path);
+
+private:
+    struct Task
+    {
+        std::string path;
+        onResult cb;
+    };
+
+    mutable std::mutex _mtx;
+    std::condition_variable _cond;
+    std::deque<Task> _tasks;
+    size_t _max_threads = 1;
+    size_t _threads = 0;
+    size_t _idle_threads = 0;
+    std::atomic<int> _level{6};
+    Result _total;
+};
+
+#endif
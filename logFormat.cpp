@@ -0,0 +1,39 @@
+#include "logFormat.h"
+
+void logFmtLiteral(LogStreamBuf &buf, const char *begin, const char *end)
+{
+    while (begin < end)
+    {
+        auto pos = begin;
+        while (pos < end && *pos != '{' && *pos != '}')
+        {
+            ++pos;
+        }
+        if (pos < end)
+        {
+            // {{或}}，只保留一个
+            ++pos;
+            buf.append(begin, pos - begin);
+            begin = pos + 1;
+            continue;
+        }
+        buf.append(begin, pos - begin);
+        begin = pos;
+    }
+}
+
+void logFmtString(LogStreamBuf &buf, const LogFmtSpec &spec, std::string_view str)
+{
+    if (spec.precision >= 0 && (size_t)spec.precision < str.size())
+    {
+        // 精度为字符串最大长度
+        str = str.substr(0, spec.precision);
+    }
+    buf.append(str.data(), str.size());
+}
+
+void logFmtPointer(LogStreamBuf &buf, const void *ptr)
+{
+    buf.append("0x", 2);
+    logFmtInteger(buf, LogFmtSpec{'x', -1}, (uintptr_t)ptr);
+}
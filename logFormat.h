@@ -0,0 +1,377 @@
+#ifndef LOG_FORMAT_H
+#define LOG_FORMAT_H
+
+#include <charconv>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include "logger.h"
+
+/**
+ * 格式串接口，例如 InfoF("x={} y={:.3f} mask={:x}", x, y, mask)
+ * 格式串在编译期解析，占位符个数及类型与参数不符时编译失败
+ * 数值通过std::to_chars直接写入日志缓冲区，不经过ostream
+ *
+ * 占位符格式为{}或{:[.精度][类型]}，{{与}}分别表示字面的{与}
+ * 类型: d/x/X/o/b 整数，f/e/g 浮点，s 字符串，p 指针
+ * 自定义类型可特化LogFormatter<T>，否则通过operator<<输出
+ */
+
+struct LogFmtSpec
+{
+    // 0为默认格式
+    char type = 0;
+    // -1为未指定
+    int precision = -1;
+};
+
+enum LogFmtCategory : char
+{
+    LogFmtInt = 'i',
+    LogFmtChar = 'c',
+    LogFmtBool = 'b',
+    LogFmtFloat = 'f',
+    LogFmtString = 's',
+    LogFmtPointer = 'p',
+    LogFmtCustom = 'u'
+};
+
+template <typename T>
+constexpr LogFmtCategory logFmtCategory()
+{
+    using U = typename std::remove_cv<T>::type;
+    if constexpr (std::is_same<U, bool>::value)
+        return LogFmtBool;
+    else if constexpr (std::is_same<U, char>::value)
+        return LogFmtChar;
+    else if constexpr (std::is_integral<U>::value)
+        return LogFmtInt;
+    else if constexpr (std::is_floating_point<U>::value)
+        return LogFmtFloat;
+    else if constexpr (std::is_same<U, const char *>::value || std::is_same<U, char *>::value ||
+                       std::is_same<U, std::string>::value || std::is_same<U, std::string_view>::value)
+        return LogFmtString;
+    else if constexpr (std::is_pointer<U>::value || std::is_null_pointer<U>::value)
+        return LogFmtPointer;
+    else
+        return LogFmtCustom;
+}
+
+struct LogFmtToken
+{
+    bool found = false;
+    bool error = false;
+    // 占位符之前的字面文本结束位置
+    size_t literal_end = 0;
+    // 占位符之后的位置
+    size_t next = 0;
+    LogFmtSpec spec;
+};
+
+/**
+ * 查找从pos开始的下一个占位符，编译期与运行期共用
+ */
+constexpr LogFmtToken logFmtNext(const char *fmt, size_t pos)
+{
+    LogFmtToken token;
+    for (;;)
+    {
+        char ch = fmt[pos];
+        if (ch == '\0')
+        {
+            token.literal_end = pos;
+            token.next = pos;
+            return token;
+        }
+        if (ch == '}')
+        {
+            if (fmt[pos + 1] != '}')
+            {
+                token.error = true;
+                return token;
+            }
+            pos += 2;
+            continue;
+        }
+        if (ch != '{')
+        {
+            ++pos;
+            continue;
+        }
+        if (fmt[pos + 1] == '{')
+        {
+            pos += 2;
+            continue;
+        }
+        token.literal_end = pos++;
+        if (fmt[pos] == ':')
+        {
+            ++pos;
+            if (fmt[pos] == '.')
+            {
+                ++pos;
+                if (fmt[pos] < '0' || fmt[pos] > '9')
+                {
+                    token.error = true;
+                    return token;
+                }
+                token.spec.precision = 0;
+                while (fmt[pos] >= '0' && fmt[pos] <= '9')
+                {
+                    token.spec.precision = token.spec.precision * 10 + (fmt[pos++] - '0');
+                    if (token.spec.precision > 1000)
+                    {
+                        token.error = true;
+                        return token;
+                    }
+                }
+            }
+            switch (fmt[pos])
+            {
+            case 'd': case 'x': case 'X': case 'o': case 'b':
+            case 'f': case 'e': case 'g': case 's': case 'p':
+                token.spec.type = fmt[pos++];
+                break;
+            default:
+                break;
+            }
+        }
+        if (fmt[pos] != '}')
+        {
+            token.error = true;
+            return token;
+        }
+        token.found = true;
+        token.next = pos + 1;
+        return token;
+    }
+}
+
+/**
+ * 占位符个数，格式串有语法错误时返回-1
+ */
+constexpr int logFmtCount(const char *fmt)
+{
+    int count = 0;
+    size_t pos = 0;
+    for (;;)
+    {
+        auto token = logFmtNext(fmt, pos);
+        if (token.error)
+        {
+            return -1;
+        }
+        if (!token.found)
+        {
+            return count;
+        }
+        ++count;
+        pos = token.next;
+    }
+}
+
+constexpr bool logFmtAccepts(const LogFmtSpec &spec, LogFmtCategory category)
+{
+    switch (spec.type)
+    {
+    case 0:
+        return spec.precision < 0 || category == LogFmtFloat || category == LogFmtString;
+    case 'd': case 'x': case 'X': case 'o': case 'b':
+        return spec.precision < 0 && (category == LogFmtInt || category == LogFmtChar);
+    case 'f': case 'e': case 'g':
+        return category == LogFmtFloat;
+    case 's':
+        return category == LogFmtString || (spec.precision < 0 && category == LogFmtBool);
+    case 'p':
+        return spec.precision < 0 && category == LogFmtPointer;
+    default:
+        return false;
+    }
+}
+
+template <typename... Args>
+constexpr bool logFmtCheck(const char *fmt)
+{
+    constexpr LogFmtCategory categories[] = {logFmtCategory<Args>()..., LogFmtCustom};
+    size_t pos = 0;
+    for (size_t i = 0; i < sizeof...(Args); ++i)
+    {
+        auto token = logFmtNext(fmt, pos);
+        if (!token.found || !logFmtAccepts(token.spec, categories[i]))
+        {
+            return false;
+        }
+        pos = token.next;
+    }
+    return true;
+}
+
+/**
+ * 自定义类型格式化扩展点，特化后直接写入ctx.buffer()即可绕过ostream，例如
+ * template <> struct LogFormatter<Point> {
+ *     static void format(LogContext &ctx, const Point &pt) { ... ctx.buffer().append(...); }
+ * };
+ */
+template <typename T, typename = void>
+struct LogFormatter
+{
+    static void format(LogContext &ctx, const T &value)
+    {
+        ctx << value;
+    }
+};
+
+// 输出字面文本，并把{{与}}还原为{与}
+void logFmtLiteral(LogStreamBuf &buf, const char *begin, const char *end);
+void logFmtString(LogStreamBuf &buf, const LogFmtSpec &spec, std::string_view str);
+void logFmtPointer(LogStreamBuf &buf, const void *ptr);
+
+template <typename T>
+void logFmtInteger(LogStreamBuf &buf, const LogFmtSpec &spec, T value)
+{
+    int base = 10;
+    switch (spec.type)
+    {
+    case 'x': case 'X': base = 16; break;
+    case 'o': base = 8; break;
+    case 'b': base = 2; break;
+    default: break;
+    }
+    // 二进制最长为位数加符号
+    auto first = buf.prepare(sizeof(T) * 8 + 1);
+    auto last = std::to_chars(first, first + sizeof(T) * 8 + 1, value, base).ptr;
+    if (spec.type == 'X')
+    {
+        for (auto p = first; p != last; ++p)
+        {
+            if (*p >= 'a' && *p <= 'f')
+            {
+                *p -= 'a' - 'A';
+            }
+        }
+    }
+    buf.commit(last - first);
+}
+
+template <typename T>
+void logFmtFloat(LogStreamBuf &buf, const LogFmtSpec &spec, T value)
+{
+    for (size_t size = 64;; size *= 4)
+    {
+        auto first = buf.prepare(size);
+        std::to_chars_result ret;
+        switch (spec.type)
+        {
+        case 'f': ret = std::to_chars(first, first + size, value, std::chars_format::fixed, spec.precision < 0 ? 6 : spec.precision); break;
+        case 'e': ret = std::to_chars(first, first + size, value, std::chars_format::scientific, spec.precision < 0 ? 6 : spec.precision); break;
+        case 'g': ret = std::to_chars(first, first + size, value, std::chars_format::general, spec.precision < 0 ? 6 : spec.precision); break;
+        default:
+            ret = spec.precision < 0 ? std::to_chars(first, first + size, value)
+                                     : std::to_chars(first, first + size, value, std::chars_format::general, spec.precision);
+            break;
+        }
+        if (ret.ec == std::errc())
+        {
+            buf.commit(ret.ptr - first);
+            return;
+        }
+    }
+}
+
+template <typename T>
+void logFmtArg(LogContext &ctx, const LogFmtSpec &spec, const T &value)
+{
+    auto &buf = ctx.buffer();
+    constexpr auto category = logFmtCategory<T>();
+    if constexpr (category == LogFmtBool)
+    {
+        buf.append(value ? "true" : "false", value ? 4 : 5);
+    }
+    else if constexpr (category == LogFmtChar)
+    {
+        if (spec.type)
+        {
+            logFmtInteger(buf, spec, (int)value);
+        }
+        else
+        {
+            buf.append(&value, 1);
+        }
+    }
+    else if constexpr (category == LogFmtInt)
+    {
+        logFmtInteger(buf, spec, value);
+    }
+    else if constexpr (category == LogFmtFloat)
+    {
+        logFmtFloat(buf, spec, value);
+    }
+    else if constexpr (category == LogFmtString)
+    {
+        if constexpr (std::is_pointer<T>::value)
+        {
+            logFmtString(buf, spec, value ? std::string_view(value) : std::string_view("(null)"));
+        }
+        else
+        {
+            logFmtString(buf, spec, std::string_view(value));
+        }
+    }
+    else if constexpr (category == LogFmtPointer)
+    {
+        logFmtPointer(buf, (const void *)value);
+    }
+    else
+    {
+        LogFormatter<T>::format(ctx, value);
+    }
+}
+
+template <typename T>
+void logFmtNextArg(LogContext &ctx, const char *fmt, size_t &pos, const T &value)
+{
+    auto token = logFmtNext(fmt, pos);
+    logFmtLiteral(ctx.buffer(), fmt + pos, fmt + token.literal_end);
+    logFmtArg<T>(ctx, token.spec, value);
+    pos = token.next;
+}
+
+template <typename S, typename... Args>
+void logFormat(LogCapturer &&capturer, S fmt, const Args &...args)
+{
+    static_assert(logFmtCount(S::str()) >= 0, "log format string: unmatched brace or malformed placeholder");
+    static_assert(logFmtCount(S::str()) == (int)sizeof...(Args), "log format string: placeholder count does not match argument count");
+    static_assert(logFmtCheck<typename std::decay<const Args>::type...>(S::str()), "log format string: placeholder type does not match argument type");
+    if (!capturer._ctx)
+    {
+        return;
+    }
+    auto &ctx = *capturer._ctx;
+    const char *str = S::str();
+    size_t pos = 0;
+    (logFmtNextArg<typename std::decay<const Args>::type>(ctx, str, pos, args), ...);
+    auto token = logFmtNext(str, pos);
+    logFmtLiteral(ctx.buffer(), str + pos, str + token.literal_end);
+}
+
+// 把字符串字面量包装为可在编译期读取的类型
+#define LOG_FMT_STRING(s)                                     \
+    []() {                                                    \
+        struct LogFmtStr                                      \
+        {                                                     \
+            static constexpr const char *str() { return s; } \
+        };                                                    \
+        return LogFmtStr();                                   \
+    }()
+
+#define WriteF(level, fmt, ...) \
+    if (static constexpr auto s_log_site = LOG_CALL_SITE(""); !getLogger().enabled(s_log_site, level)) {} \
+    else logFormat(LogCapturer(getLogger(), s_log_site, level), LOG_FMT_STRING(fmt), ##__VA_ARGS__)
+#define TraceF(fmt, ...) WriteF(LTrace, fmt, ##__VA_ARGS__)
+#define DebugF(fmt, ...) WriteF(LDebug, fmt, ##__VA_ARGS__)
+#define InfoF(fmt, ...) WriteF(LInfo, fmt, ##__VA_ARGS__)
+#define WarnF(fmt, ...) WriteF(LWarn, fmt, ##__VA_ARGS__)
+#define ErrorF(fmt, ...) WriteF(LError, fmt, ##__VA_ARGS__)
+
+#endif
@@ -0,0 +1,267 @@
+#include "logRecorder.h"
+#include <cerrno>
+#include <cstddef>
+#include <algorithm>
+#if !defined(_WIN32)
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+static const uint64_t s_recorder_magic = 0x4c4f47464c494748ULL;
+static const uint32_t s_recorder_version = 2;
+
+struct LogFlightRecorder::Header
+{
+    uint64_t magic;
+    uint32_t version;
+    uint32_t slot_size;
+    uint64_t slot_count;
+    int64_t pid;
+    // 下一条日志的序号，独占缓存行
+    alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> next;
+};
+
+/**
+ * 序号为n的日志写入期间seq为2n+1，写完后为2n+2，0表示空槽位
+ * 读取时seq为奇数或前后两次读取不一致的槽位视为不完整并跳过
+ */
+struct LogFlightRecorder::Slot
+{
+    std::atomic<uint64_t> seq;
+    int64_t sec;
+    int32_t usec;
+    uint32_t line;
+    uint64_t tid;
+    uint8_t level;
+    uint8_t file_len;
+    uint16_t reserved;
+    uint32_t len;
+    // 延迟格式化参数的字节数
+    uint32_t args_len;
+    // 文件名后依次为日志文本与延迟格式化参数
+    char data[1];
+};
+
+static const size_t s_slot_head = offsetof(LogFlightRecorder::Slot, data);
+
+LogFlightRecorder::LogFlightRecorder(const std::string &path, size_t slot_count, size_t slot_size, LogLevel level)
+    : _path(path), _level(level), _slot_count(std::max<size_t>(slot_count, 1))
+{
+    _slot_size = (std::max(slot_size, s_slot_head + 64) + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE * CACHE_LINE_SIZE;
+#if !defined(_WIN32)
+    int fd = ::open(_path.data(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd == -1)
+    {
+        return;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(Header))
+    {
+        auto old = (char *)mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (old != MAP_FAILED)
+        {
+            auto pid = ((Header *)old)->pid;
+            if (pid > 0 && pid != getpid() && (kill((pid_t)pid, 0) == 0 || errno == EPERM))
+            {
+                // 文件属于仍在运行的进程，改用本进程专属的文件
+                munmap(old, st.st_size);
+                ::close(fd);
+                _path += "." + std::to_string(getpid());
+                fd = ::open(_path.data(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+                if (fd == -1)
+                {
+                    return;
+                }
+            }
+            else
+            {
+                _previous = readRecords(old, st.st_size, SIZE_MAX);
+                munmap(old, st.st_size);
+            }
+        }
+    }
+    _map_size = sizeof(Header) + _slot_count * _slot_size;
+    if (ftruncate(fd, 0) != 0 || ftruncate(fd, _map_size) != 0)
+    {
+        ::close(fd);
+        return;
+    }
+    auto base = mmap(nullptr, _map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0);
+    // 映射建立后文件描述符不再需要
+    ::close(fd);
+    if (base == MAP_FAILED)
+    {
+        return;
+    }
+    _base = (char *)base;
+    _header = new (_base) Header;
+    _header->version = s_recorder_version;
+    _header->slot_size = (uint32_t)_slot_size;
+    _header->slot_count = _slot_count;
+    _header->pid = getpid();
+    _header->next.store(0, std::memory_order_relaxed);
+    // 最后写入magic，读取方据此判断头部已初始化
+    std::atomic_thread_fence(std::memory_order_release);
+    _header->magic = s_recorder_magic;
+#endif
+}
+
+LogFlightRecorder::~LogFlightRecorder()
+{
+#if !defined(_WIN32)
+    if (_base)
+    {
+        // 正常退出时保留文件内容，便于事后查看
+        munmap(_base, _map_size);
+    }
+#endif
+}
+
+bool LogFlightRecorder::valid() const
+{
+    return _header != nullptr;
+}
+
+LogLevel LogFlightRecorder::getLevel() const
+{
+    return _level;
+}
+
+const std::string &LogFlightRecorder::path() const
+{
+    return _path;
+}
+
+const std::vector<std::string> &LogFlightRecorder::previous() const
+{
+    return _previous;
+}
+
+LogFlightRecorder::Slot *LogFlightRecorder::slotAt(uint64_t index) const
+{
+    return (Slot *)(_base + sizeof(Header) + (index % _slot_count) * _slot_size);
+}
+
+void LogFlightRecorder::record(LogContext &ctx)
+{
+    if (!_header || ctx._level < _level)
+    {
+        return;
+    }
+    auto seq = _header->next.fetch_add(1, std::memory_order_relaxed);
+    auto slot = slotAt(seq);
+    slot->seq.store(seq * 2 + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    slot->sec = ctx._tv.tv_sec;
+    slot->usec = (int32_t)ctx._tv.tv_usec;
+    slot->line = (uint32_t)ctx._site->line;
+    slot->tid = ctx._thread_id;
+    slot->level = (uint8_t)ctx._level;
+    size_t capacity = _slot_size - s_slot_head;
+    size_t file_len = std::min<size_t>(std::min<size_t>(strlen(ctx._site->file), 255), capacity);
+    memcpy(slot->data, ctx._site->file, file_len);
+    // 不调用str()，延迟格式化的参数按原始字节保存
+    size_t len = std::min(ctx._sbuf.size(), capacity - file_len);
+    memcpy(slot->data + file_len, ctx._sbuf.data(), len);
+    size_t args_len = 0;
+    if (ctx._deferred)
+    {
+        args_len = std::min(ctx._args.size(), capacity - file_len - len);
+        memcpy(slot->data + file_len + len, ctx._args.data(), args_len);
+    }
+    slot->file_len = (uint8_t)file_len;
+    slot->len = (uint32_t)len;
+    slot->args_len = (uint32_t)args_len;
+
+    slot->seq.store(seq * 2 + 2, std::memory_order_release);
+}
+
+std::vector<std::string> LogFlightRecorder::readRecords(const char *base, size_t size, size_t max_count)
+{
+    std::vector<std::string> ret;
+    auto header = (const Header *)base;
+    if (size < sizeof(Header) || header->magic != s_recorder_magic || header->version != s_recorder_version ||
+        header->slot_size < s_slot_head || header->slot_size % CACHE_LINE_SIZE || !header->slot_count ||
+        header->slot_count > (size - sizeof(Header)) / header->slot_size)
+    {
+        return ret;
+    }
+
+    struct Record
+    {
+        uint64_t seq;
+        std::string text;
+    };
+    std::vector<Record> records;
+    std::string text;
+    for (uint64_t i = 0; i < header->slot_count; ++i)
+    {
+        auto slot = (Slot *)(base + sizeof(Header) + i * header->slot_size);
+        auto seq = slot->seq.load(std::memory_order_acquire);
+        if (!seq || (seq & 1))
+        {
+            continue;
+        }
+        size_t capacity = header->slot_size - s_slot_head;
+        size_t file_len = std::min<size_t>(slot->file_len, capacity);
+        size_t len = std::min<size_t>(slot->len, capacity - file_len);
+        size_t args_len = std::min<size_t>(slot->args_len, capacity - file_len - len);
+        char time_buf[64];
+        struct timeval tv = {(time_t)slot->sec, (suseconds_t)slot->usec};
+        text.assign(time_buf, LogChannel::printTime(tv, time_buf, sizeof(time_buf), 6));
+        text.append(" ").append(1, "TDIWE?"[std::min<int>(slot->level, 5)]);
+        text.append(" [").append(std::to_string(slot->tid)).append("] ");
+        text.append(slot->data, file_len).append(":").append(std::to_string(slot->line)).append(" | ");
+        text.append(slot->data + file_len, len);
+        if (args_len)
+        {
+            // 流操纵符是写入进程中的函数指针，不能执行
+            std::ostringstream ost;
+            LogContext::renderArgs(ost, slot->data + file_len + len, args_len, false);
+            text.append(ost.str());
+        }
+        // 拷贝期间槽位被覆盖则丢弃
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot->seq.load(std::memory_order_relaxed) != seq)
+        {
+            continue;
+        }
+        records.push_back({seq, text});
+    }
+    std::sort(records.begin(), records.end(), [](const Record &a, const Record &b)
+              { return a.seq < b.seq; });
+    size_t skip = records.size() > max_count ? records.size() - max_count : 0;
+    for (size_t i = skip; i < records.size(); ++i)
+    {
+        ret.emplace_back(std::move(records[i].text));
+    }
+    return ret;
+}
+
+std::vector<std::string> LogFlightRecorder::recover(const std::string &path, size_t max_count)
+{
+    std::vector<std::string> ret;
+#if !defined(_WIN32)
+    int fd = ::open(path.data(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+    {
+        return ret;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(Header))
+    {
+        auto base = (char *)mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (base != MAP_FAILED)
+        {
+            ret = readRecords(base, st.st_size, max_count);
+            munmap(base, st.st_size);
+        }
+    }
+    ::close(fd);
+#endif
+    return ret;
+}
@@ -0,0 +1,73 @@
+#ifndef LOG_RECORDER_H
+#define LOG_RECORDER_H
+
+#include <atomic>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include "logger.h"
+
+/**
+ * 基于共享内存文件的飞行记录器
+ * 日志在调用线程以二进制形式写入映射到/dev/shm文件的环形槽位，每条带递增序号
+ * 进程崩溃时页面仍保留在文件中，下次启动或通过recover可读出最后N条日志
+ * 写入只需一次原子自增与一次内存拷贝，不加锁、不进行系统调用，超出槽位的内容被截断
+ * 延迟格式化的日志不在调用线程渲染，槽位保存已有文本与参数的原始字节，读取时再转换为文本
+ * 代价是读出的内容忽略std::hex等流操纵符与格式设置，截断处不完整的参数整个丢弃
+ */
+class LogFlightRecorder : public noncopyable
+{
+public:
+    using Ptr = std::shared_ptr<LogFlightRecorder>;
+
+    /**
+     * @param path 共享内存文件路径
+     * @param slot_count 槽位个数，即保留的最近日志条数
+     * @param slot_size 每个槽位字节数，向上取整为64的倍数
+     * @param level 记录的最低日志等级
+     */
+    LogFlightRecorder(const std::string &path = "/dev/shm/" + exeName() + ".flight", size_t slot_count = 4096, size_t slot_size = 256, LogLevel level = LDebug);
+    ~LogFlightRecorder();
+
+    // 共享内存是否映射成功
+    bool valid() const;
+    LogLevel getLevel() const;
+    const std::string &path() const;
+
+    /**
+     * 记录一条日志，可在任意线程调用
+     */
+    void record(LogContext &ctx);
+
+    /**
+     * 打开时发现的上一个已退出进程遗留的日志，按时间先后排列
+     */
+    const std::vector<std::string> &previous() const;
+
+    /**
+     * 读取记录文件中最近的日志，可用于已崩溃进程的文件
+     * @param max_count 最多读取条数
+     * @return 按序号排列的日志文本
+     */
+    static std::vector<std::string> recover(const std::string &path, size_t max_count = SIZE_MAX);
+
+    // 共享内存中的文件头与槽位布局
+    struct Header;
+    struct Slot;
+
+private:
+    Slot *slotAt(uint64_t index) const;
+    static std::vector<std::string> readRecords(const char *base, size_t size, size_t max_count);
+
+private:
+    std::string _path;
+    LogLevel _level;
+    char *_base = nullptr;
+    size_t _map_size = 0;
+    size_t _slot_count;
+    size_t _slot_size;
+    Header *_header = nullptr;
+    std::vector<std::string> _previous;
+};
+
+#endif
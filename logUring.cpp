@@ -0,0 +1,510 @@
+#include "logger.h"
+#include <cerrno>
+#include <cstdlib>
+#include <algorithm>
+#include <unistd.h>
+#include <fcntl.h>
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define ENABLE_IO_URING
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+#endif
+
+#if defined(ENABLE_IO_URING)
+
+/**
+ * io_uring的最小封装，直接使用系统调用，不依赖liburing
+ * 只在写线程中使用，提交与收割都不需要加锁
+ */
+class LogUring : public noncopyable
+{
+public:
+    ~LogUring()
+    {
+        if (_sqes)
+        {
+            munmap(_sqes, _sqes_size);
+        }
+        if (_cq_ptr && _cq_ptr != _sq_ptr)
+        {
+            munmap(_cq_ptr, _cq_size);
+        }
+        if (_sq_ptr)
+        {
+            munmap(_sq_ptr, _sq_size);
+        }
+        if (_fd != -1)
+        {
+            ::close(_fd);
+        }
+    }
+
+    bool init(unsigned entries)
+    {
+        struct io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        _fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+        if (_fd < 0)
+        {
+            // 内核不支持或被seccomp禁用
+            _fd = -1;
+            return false;
+        }
+        _sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        _cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+        bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (single_mmap)
+        {
+            _sq_size = _cq_size = std::max(_sq_size, _cq_size);
+        }
+        _sq_ptr = mmap(nullptr, _sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_SQ_RING);
+        if (_sq_ptr == MAP_FAILED)
+        {
+            _sq_ptr = nullptr;
+            return false;
+        }
+        if (single_mmap)
+        {
+            _cq_ptr = _sq_ptr;
+        }
+        else
+        {
+            _cq_ptr = mmap(nullptr, _cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_CQ_RING);
+            if (_cq_ptr == MAP_FAILED)
+            {
+                _cq_ptr = nullptr;
+                return false;
+            }
+        }
+        _sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+        auto sqes = mmap(nullptr, _sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_SQES);
+        if (sqes == MAP_FAILED)
+        {
+            return false;
+        }
+        _sqes = (struct io_uring_sqe *)sqes;
+
+        auto sq = (char *)_sq_ptr;
+        _sq_head = (unsigned *)(sq + params.sq_off.head);
+        _sq_tail = (unsigned *)(sq + params.sq_off.tail);
+        _sq_mask = *(unsigned *)(sq + params.sq_off.ring_mask);
+        _sq_array = (unsigned *)(sq + params.sq_off.array);
+        auto cq = (char *)_cq_ptr;
+        _cq_head = (unsigned *)(cq + params.cq_off.head);
+        _cq_tail = (unsigned *)(cq + params.cq_off.tail);
+        _cq_mask = *(unsigned *)(cq + params.cq_off.ring_mask);
+        _cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+        _sq_entries = params.sq_entries;
+        return true;
+    }
+
+    /**
+     * 注册固定缓冲，失败(例如超出RLIMIT_MEMLOCK)时改用普通写请求
+     */
+    bool registerBuffers(const struct iovec *iov, unsigned count)
+    {
+        _fixed = syscall(__NR_io_uring_register, _fd, IORING_REGISTER_BUFFERS, iov, count) == 0;
+        return _fixed;
+    }
+
+    /**
+     * 在提交队列中放入一个写请求，需调用submit才会真正提交
+     */
+    bool write(int fd, const void *buf, unsigned len, uint64_t offset, unsigned buf_index, uint64_t user_data)
+    {
+        unsigned tail = *_sq_tail;
+        if (tail - __atomic_load_n(_sq_head, __ATOMIC_ACQUIRE) >= _sq_entries)
+        {
+            return false;
+        }
+        unsigned index = tail & _sq_mask;
+        auto sqe = &_sqes[index];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = _fixed ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+        sqe->fd = fd;
+        sqe->addr = (uint64_t)(uintptr_t)buf;
+        sqe->len = len;
+        sqe->off = offset;
+        sqe->buf_index = _fixed ? buf_index : 0;
+        sqe->user_data = user_data;
+        _sq_array[index] = index;
+        __atomic_store_n(_sq_tail, tail + 1, __ATOMIC_RELEASE);
+        ++_to_submit;
+        return true;
+    }
+
+    /**
+     * @return 已提交个数，失败返回-errno
+     */
+    int submit()
+    {
+        while (_to_submit)
+        {
+            int ret = enter(_to_submit, 0, 0);
+            if (ret < 0)
+            {
+                if (ret == -EINTR)
+                {
+                    continue;
+                }
+                return ret;
+            }
+            _to_submit -= ret;
+        }
+        return 0;
+    }
+
+    /**
+     * 取出一个完成事件
+     * @param block 没有完成事件时是否等待
+     */
+    bool reap(uint64_t &user_data, int &res, bool block)
+    {
+        for (;;)
+        {
+            unsigned head = *_cq_head;
+            if (head != __atomic_load_n(_cq_tail, __ATOMIC_ACQUIRE))
+            {
+                auto cqe = &_cqes[head & _cq_mask];
+                user_data = cqe->user_data;
+                res = cqe->res;
+                __atomic_store_n(_cq_head, head + 1, __ATOMIC_RELEASE);
+                return true;
+            }
+            if (!block)
+            {
+                return false;
+            }
+            // 顺带提交之前提交失败而留在队列中的请求，否则等待的完成事件永远不会到来
+            int ret = enter(_to_submit, 1, IORING_ENTER_GETEVENTS);
+            if (ret < 0 && ret != -EINTR)
+            {
+                return false;
+            }
+            if (ret > 0)
+            {
+                _to_submit -= std::min<unsigned>(ret, _to_submit);
+            }
+        }
+    }
+
+private:
+    int enter(unsigned to_submit, unsigned min_complete, unsigned flags)
+    {
+        int ret = (int)syscall(__NR_io_uring_enter, _fd, to_submit, min_complete, flags, nullptr, 0);
+        return ret < 0 ? -errno : ret;
+    }
+
+private:
+    int _fd = -1;
+    bool _fixed = false;
+    unsigned _to_submit = 0;
+    unsigned _sq_entries = 0;
+    void *_sq_ptr = nullptr;
+    void *_cq_ptr = nullptr;
+    size_t _sq_size = 0;
+    size_t _cq_size = 0;
+    size_t _sqes_size = 0;
+    struct io_uring_sqe *_sqes = nullptr;
+    unsigned *_sq_head = nullptr;
+    unsigned *_sq_tail = nullptr;
+    unsigned *_sq_array = nullptr;
+    unsigned _sq_mask = 0;
+    unsigned *_cq_head = nullptr;
+    unsigned *_cq_tail = nullptr;
+    struct io_uring_cqe *_cqes = nullptr;
+    unsigned _cq_mask = 0;
+};
+
+#else
+
+// 不支持io_uring的平台，init总是失败，通道退化为同步写入
+class LogUring : public noncopyable
+{
+public:
+    bool init(unsigned) { return false; }
+    bool registerBuffers(const struct iovec *, unsigned) { return false; }
+    bool write(int, const void *, unsigned, uint64_t, unsigned, uint64_t) { return false; }
+    int submit() { return -1; }
+    bool reap(uint64_t &, int &, bool) { return false; }
+};
+
+#endif
+
+// 同步写入整块数据，用于部分写入的补写及提交失败时的退化
+static bool writeAt(int fd, const char *data, size_t size, uint64_t offset)
+{
+#if !defined(_WIN32)
+    while (size)
+    {
+        auto n = ::pwrite(fd, data, size, (off_t)offset);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return false;
+        }
+        data += n;
+        size -= n;
+        offset += n;
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
+///////////////////////////////LogUringFileChannel/////////////////////////
+LogUringFileChannel::LogUringFileChannel(const std::string &name, const std::string &dir, LogLevel level, size_t depth, size_t buffer_size)
+    : LogFileChannel(name, dir, level), _slot_size(std::max<size_t>(buffer_size, 4096))
+{
+    depth = std::max<size_t>(depth, 1);
+    std::unique_ptr<LogUring> ring(new LogUring);
+    if (!ring->init((unsigned)depth))
+    {
+        return;
+    }
+    _slots.resize(depth);
+    std::vector<struct iovec> iov(depth);
+    for (size_t i = 0; i < depth; ++i)
+    {
+        void *ptr = nullptr;
+        if (posix_memalign(&ptr, 4096, _slot_size) != 0)
+        {
+            for (size_t j = 0; j < i; ++j)
+            {
+                free(_slots[j].data);
+            }
+            _slots.clear();
+            return;
+        }
+        _slots[i].data = (char *)ptr;
+        iov[i] = {ptr, _slot_size};
+    }
+    ring->registerBuffers(iov.data(), (unsigned)depth);
+    _ring = std::move(ring);
+}
+
+LogUringFileChannel::~LogUringFileChannel()
+{
+    // 基类析构时已无法调用本类的close
+    close();
+    _ring.reset();
+    for (auto &slot : _slots)
+    {
+        free(slot.data);
+    }
+}
+
+bool LogUringFileChannel::uringEnabled() const
+{
+    return _ring != nullptr;
+}
+
+bool LogUringFileChannel::open()
+{
+    // 基类open会先调用close，等待旧文件的在途请求完成
+    if (!FileChannelBase::open())
+    {
+        return false;
+    }
+    if (_ring)
+    {
+        // 多个请求并行完成，必须按显式偏移写入，不能使用O_APPEND
+        int flags = fcntl(_fd, F_GETFL);
+        if (flags != -1)
+        {
+            fcntl(_fd, F_SETFL, flags & ~O_APPEND);
+        }
+        _offset = _file_size;
+    }
+    return true;
+}
+
+void LogUringFileChannel::close()
+{
+    FileChannelBase::flush();
+    if (_ring && _ring_failed)
+    {
+        disableRing();
+    }
+    drain();
+    FileChannelBase::close();
+}
+
+bool LogUringFileChannel::writeOut(struct iovec *iov, int count, size_t bytes)
+{
+    if (_ring && _ring_failed)
+    {
+        disableRing();
+    }
+    if (!_ring)
+    {
+        return FileChannelBase::writeOut(iov, count, bytes);
+    }
+    if (_fd == -1)
+    {
+        return false;
+    }
+    // 先回收已完成的缓冲，不等待
+    reap(false);
+    for (int i = 0; i < count; ++i)
+    {
+        auto data = (const char *)iov[i].iov_base;
+        auto size = iov[i].iov_len;
+        while (size)
+        {
+            if (_cur == -1 && !acquireSlot())
+            {
+                // 在途请求无法收割，本批剩余数据同步写入，之后停用io_uring
+                _ring_failed = true;
+                bool ret = writeAt(_fd, data, size, _offset);
+                _offset += size;
+                for (++i; i < count; ++i)
+                {
+                    ret = writeAt(_fd, (const char *)iov[i].iov_base, iov[i].iov_len, _offset) && ret;
+                    _offset += iov[i].iov_len;
+                }
+                return ret;
+            }
+            auto &slot = _slots[_cur];
+            auto n = std::min(size, _slot_size - slot.used);
+            memcpy(slot.data + slot.used, data, n);
+            slot.used += n;
+            data += n;
+            size -= n;
+            if (slot.used == _slot_size && !submitSlot())
+            {
+                return false;
+            }
+        }
+    }
+    // 本批数据全部提交，不在缓冲中停留
+    return _cur == -1 || submitSlot();
+}
+
+bool LogUringFileChannel::submitSlot()
+{
+    auto index = _cur;
+    auto &slot = _slots[index];
+    _cur = -1;
+    slot.offset = _offset;
+    _offset += slot.used;
+    if (!_ring->write(_fd, slot.data, (unsigned)slot.used, slot.offset, (unsigned)index, (uint64_t)index))
+    {
+        // 提交队列已满，请求未放入队列，同步写入
+        bool ret = writeAt(_fd, slot.data, slot.used, slot.offset);
+        slot.used = 0;
+        return ret;
+    }
+    // 请求已放入提交队列，之后的提交会把它带给内核，缓冲在完成前不能同步写入或复用
+    slot.busy = true;
+    ++_inflight;
+    if (_ring->submit() < 0)
+    {
+        _ring_failed = true;
+    }
+    return true;
+}
+
+bool LogUringFileChannel::acquireSlot()
+{
+    for (;;)
+    {
+        for (size_t i = 0; i < _slots.size(); ++i)
+        {
+            if (!_slots[i].busy)
+            {
+                _cur = (int)i;
+                _slots[i].used = 0;
+                return true;
+            }
+        }
+        auto inflight = _inflight;
+        reap(true);
+        if (_inflight == inflight)
+        {
+            return false;
+        }
+    }
+}
+
+void LogUringFileChannel::reap(bool wait)
+{
+    uint64_t user_data;
+    int res;
+    while (_inflight && _ring->reap(user_data, res, wait))
+    {
+        wait = false;
+        auto &slot = _slots[user_data];
+        if (res >= 0 && (size_t)res < slot.used)
+        {
+            // 部分写入，补写剩余部分
+            writeAt(_fd, slot.data + res, slot.used - res, slot.offset + res);
+        }
+        else if (res < 0)
+        {
+            // 任何错误都同步补写整块，EIO、ENOSPC等同步写入同样失败时数据才丢弃
+            writeAt(_fd, slot.data, slot.used, slot.offset);
+            if (res == -EINVAL || res == -EOPNOTSUPP)
+            {
+                _ring_failed = true;
+            }
+        }
+        slot.busy = false;
+        slot.used = 0;
+        --_inflight;
+    }
+}
+
+void LogUringFileChannel::disableRing()
+{
+    if (_cur != -1)
+    {
+        auto &slot = _slots[_cur];
+        writeAt(_fd, slot.data, slot.used, _offset);
+        _offset += slot.used;
+        slot.used = 0;
+        _cur = -1;
+    }
+    drain();
+    _ring.reset();
+    // 关闭后未提交的请求被丢弃；未能收割的请求按原偏移重写一遍，内核若仍在执行也只是写入相同内容
+    for (auto &slot : _slots)
+    {
+        if (slot.busy)
+        {
+            writeAt(_fd, slot.data, slot.used, slot.offset);
+            slot.busy = false;
+            slot.used = 0;
+        }
+    }
+    _inflight = 0;
+    if (_fd != -1)
+    {
+        // 所有数据已按偏移写完，恢复追加写
+        int flags = fcntl(_fd, F_GETFL);
+        if (flags != -1)
+        {
+            fcntl(_fd, F_SETFL, flags | O_APPEND);
+        }
+    }
+}
+
+void LogUringFileChannel::drain()
+{
+    while (_inflight)
+    {
+        auto inflight = _inflight;
+        reap(true);
+        if (_inflight == inflight)
+        {
+            break;
+        }
+    }
+}
@@ -3,7 +3,19 @@
 #include <sys/time.h>
 #include <cstring>
 #include "File.h"
+#include "logRecorder.h"
+#include "logCompress.h"
 #include <sys/stat.h>
+#include <fcntl.h>
+#include <cerrno>
+#include <chrono>
+#include <algorithm>
+#include <charconv>
+#if !defined(_WIN32)
+#include <sys/mman.h>
+#include <dirent.h>
+#include <signal.h>
+#endif
 
 static const auto s_second_per_day = 24 * 60 * 60;
 
@@ -37,28 +49,33 @@ static const char *LOG_CONST_TABLE[][3] = {
 
 static uint64_t getDay(time_t second)
 {
-    return (second + getGMTOff()) / s_second_per_day;
+    return (second + getGMTOff(second)) / s_second_per_day;
 }
 
-Logger *g_defaultLogger = nullptr;
-
-Logger &getLogger()
-{
-    if (!g_defaultLogger)
-    {
-        g_defaultLogger = &Logger::Instance();
-    }
-    return *g_defaultLogger;
-}
+std::atomic<Logger *> g_defaultLogger(nullptr);
 
 void setLogger(Logger *logger)
 {
-    g_defaultLogger = logger;
+    g_defaultLogger.store(logger, std::memory_order_release);
 }
 
-LogAsyncWriter::LogAsyncWriter() : m_pLogInstance(Logger::Instance()),
-                                   m_bExit(false)
+// 写线程每批次最多处理的日志条数
+static const size_t s_flush_batch = 256;
+#if defined(_WIN32)
+// windows下日志默认以模块名标识来源
+static std::string s_module_name = exeName(false);
+#endif
+
+LogAsyncWriter::LogAsyncWriter(size_t capacity, size_t max_bytes) : m_pLogInstance(Logger::Instance()),
+                                                                    _pending(capacity),
+                                                                    _max_bytes(max_bytes),
+                                                                    m_bSleeping(false),
+                                                                    m_bExit(false)
 {
+    for (auto &count : _dropped)
+    {
+        count = 0;
+    }
     m_thread = std::make_shared<std::thread>([this]()
                                              { this->run(); });
 }
@@ -68,27 +85,192 @@ LogAsyncWriter::~LogAsyncWriter()
     m_bExit = true;
     m_sem.post();
     m_thread->join();
+    // 退出前写完剩余日志
+    flushAll();
+}
+
+void LogAsyncWriter::setOverflowPolicy(LogOverflowPolicy policy, LogLevel keep_level)
+{
+    _keep_level = keep_level;
+    _policy = policy;
+}
+
+uint64_t LogAsyncWriter::dropped() const
+{
+    return _dropped_total.load(std::memory_order_relaxed);
+}
+
+size_t LogAsyncWriter::queued() const
+{
+    return _pending.size();
+}
+
+size_t LogAsyncWriter::queuedBytes() const
+{
+    return _pending_bytes.load(std::memory_order_relaxed);
+}
+
+void LogAsyncWriter::drop(const LogContextPtr &ctx, Logger &logger)
+{
+    _dropped[ctx->_level].fetch_add(1, std::memory_order_relaxed);
+    _dropped_total.fetch_add(1, std::memory_order_relaxed);
+    _drop_logger.store(&logger, std::memory_order_relaxed);
+}
+
+bool LogAsyncWriter::hasRoom(size_t bytes) const
+{
+    // 队列为空时总允许入队，否则超过字节上限的单条日志永远无法写入
+    auto size = _pending.size();
+    return size == 0 || (size < _pending.capacity() && (!_max_bytes || _pending_bytes.load(std::memory_order_relaxed) + bytes <= _max_bytes));
+}
+
+void LogAsyncWriter::waitForRoom(size_t bytes)
+{
+    std::unique_lock<std::mutex> lck(_room_mtx);
+    // 先登记再检查，与写线程出队后检查等待者的顺序配对，防止丢失唤醒
+    _room_waiters.fetch_add(1, std::memory_order_seq_cst);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    // 超时只是兜底，正常由notifyRoom唤醒
+    _room_cond.wait_for(lck, std::chrono::milliseconds(100), [&]()
+                        { return hasRoom(bytes); });
+    _room_waiters.fetch_sub(1, std::memory_order_relaxed);
+}
+
+void LogAsyncWriter::notifyRoom()
+{
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (_room_waiters.load(std::memory_order_relaxed))
+    {
+        std::lock_guard<std::mutex> lck(_room_mtx);
+        _room_cond.notify_all();
+    }
 }
 
 void LogAsyncWriter::write(const LogContextPtr &ctx, Logger &logger)
 {
+    Item item;
+    item.ctx = ctx;
+    item.logger = &logger;
+    item.bytes = ctx->bytes();
+    bool woken = false;
+    for (;;)
+    {
+        if (!_max_bytes || _pending_bytes.load(std::memory_order_relaxed) + item.bytes <= _max_bytes || _pending.size() == 0)
+        {
+            auto bytes = item.bytes;
+            if (_pending.tryPush(std::move(item)))
+            {
+                _pending_bytes.fetch_add(bytes, std::memory_order_relaxed);
+                break;
+            }
+        }
+        if (std::this_thread::get_id() == m_thread->get_id())
+        {
+            // 写线程自身产生的日志(例如打开日志文件失败)，队列满时只能丢弃，否则死锁
+            drop(ctx, logger);
+            return;
+        }
+        auto policy = _policy.load(std::memory_order_relaxed);
+        if (policy == LogOverflowDropNewest || (policy == LogOverflowDropBelowLevel && ctx->_level < _keep_level.load(std::memory_order_relaxed)))
+        {
+            drop(ctx, logger);
+            return;
+        }
+        if (policy == LogOverflowDropOldest)
+        {
+            // 最早的日志尚未写完时稍后重试，不等待写线程
+            if (!dropOldest())
+            {
+                std::this_thread::yield();
+            }
+            continue;
+        }
+        // 队列已满，本次等待只唤醒写线程一次，之后阻塞到写线程取出日志
+        if (!woken)
+        {
+            woken = true;
+            m_sem.post();
+        }
+        waitForRoom(item.bytes);
+    }
+    // 与写线程设置休眠标记后检查队列的操作配对，防止丢失唤醒
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (m_bSleeping.load(std::memory_order_relaxed) && m_bSleeping.exchange(false))
+    {
+        m_sem.post();
+    }
+}
+
+bool LogAsyncWriter::dropOldest()
+{
+    Item item;
+    if (!_pending.tryPop(item))
     {
-        std::lock_guard<std::mutex> lock(m_mutex);
-        _pending.emplace_back(std::make_pair(ctx, &logger));
+        return false;
     }
-    m_sem.post();
+    _pending_bytes.fetch_sub(item.bytes, std::memory_order_relaxed);
+    drop(item.ctx, *item.logger);
+    return true;
+}
+
+void LogAsyncWriter::reportDropped()
+{
+    auto logger = _drop_logger.exchange(nullptr, std::memory_order_relaxed);
+    if (!logger)
+    {
+        return;
+    }
+    static const char *s_level_name[] = {"trace", "debug", "info", "warn", "error"};
+    uint64_t total = 0;
+    std::string detail;
+    for (int level = LTrace; level <= LError; ++level)
+    {
+        auto count = _dropped[level].exchange(0, std::memory_order_relaxed);
+        if (count)
+        {
+            total += count;
+            detail.append(" ").append(s_level_name[level]).append(":").append(std::to_string(count));
+        }
+    }
+    if (!total)
+    {
+        return;
+    }
+    static constexpr auto s_site = LOG_CALL_SITE("");
+    auto ctx = LogContext::create(s_site, LWarn);
+    *ctx << "async log queue overflow, dropped " << total << " records," << detail;
+    logger->write_channels(ctx);
+    logger->flushChannels();
 }
 
 void LogAsyncWriter::flushAll()
 {
-    decltype(_pending) tmp;
+    _flush_loggers.clear();
+    while (_pending.popBatch([this](Item &item)
+                             {
+                                 _pending_bytes.fetch_sub(item.bytes, std::memory_order_relaxed);
+                                 item.logger->write_channels(item.ctx);
+                                 if (std::find(_flush_loggers.begin(), _flush_loggers.end(), item.logger) == _flush_loggers.end())
+                                 {
+                                     _flush_loggers.emplace_back(item.logger);
+                                 } },
+                             s_flush_batch))
+    {
+        notifyRoom();
+    }
+    // 队列已清空，通知本轮写过日志的日志器写出通道缓冲
+    for (auto logger : _flush_loggers)
     {
-        std::lock_guard<std::mutex> lock(m_mutex);
-        tmp.swap(_pending);
+        logger->flushChannels();
+        if (logger->_repeat_pending && std::find(_repeat_loggers.begin(), _repeat_loggers.end(), logger) == _repeat_loggers.end())
+        {
+            _repeat_loggers.emplace_back(logger);
+        }
     }
-    for (auto &pr : tmp)
+    // 队列清空说明压力已解除，输出期间的丢弃统计
+    if (_drop_logger.load(std::memory_order_relaxed))
     {
-        pr.second->write_channels(pr.first);
+        reportDropped();
     }
 }
 
@@ -96,391 +278,1943 @@ void LogAsyncWriter::run()
 {
     while (!m_bExit)
     {
-        m_sem.wait();
         flushAll();
+        m_bSleeping = true;
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (!_pending.empty())
+        {
+            // 休眠前又有新日志，若标记已被生产者清除则信号量会多计一次，仅导致一次空转
+            m_bSleeping = false;
+            continue;
+        }
+        auto delay = repeatFlushDelay();
+        if (delay < 0)
+        {
+            m_sem.wait();
+        }
+        else if (!m_sem.waitFor(delay))
+        {
+            // 没有新日志，输出已到期的重复次数
+            for (auto logger : _repeat_loggers)
+            {
+                logger->flushChannels();
+            }
+        }
+        m_bSleeping = false;
+    }
+}
+
+int64_t LogAsyncWriter::repeatFlushDelay()
+{
+    int64_t ret = -1;
+    for (auto it = _repeat_loggers.begin(); it != _repeat_loggers.end();)
+    {
+        auto delay = (*it)->repeatFlushDelay();
+        if (delay < 0)
+        {
+            it = _repeat_loggers.erase(it);
+            continue;
+        }
+        ret = ret < 0 ? delay : std::min(ret, delay);
+        ++it;
     }
+    return ret;
 }
 
 ///////////////////LogContext///////////////////
 
-static inline const char *getFunctionName(const char *func)
+// 不是由日志宏创建的日志使用的调用位置
+static constexpr LogCallSite s_unknown_site = {0, "", "", "", 0, {0}};
+
+// LogContext及其缓冲区的累计堆分配次数
+static std::atomic<uint64_t> s_log_alloc_count(0);
+
+LogStreamBuf::~LogStreamBuf()
 {
-#ifndef _WIN32
-    return func;
-#else
-    auto pos = strrchr(func, ':');
-    return pos ? pos + 1 : func;
-#endif
+    free(_buf);
+}
+
+void LogStreamBuf::reset()
+{
+    setp(_buf, _buf + _capacity);
+    _limit = 0;
+    _truncated = 0;
 }
 
-LogContext::LogContext(LogLevel level, const char *file, const char *function, int line, const char *module_name, const char *flag)
-    : _level(level), _line(line), _file(getFileName(file)), _function(getFunctionName(function)),
-      _module_name(module_name), _flag(flag)
+void LogStreamBuf::setLimit(size_t limit)
 {
-    gettimeofday(&_tv, nullptr);
-    _thread_name = getThreadName();
+    _limit = limit;
 }
 
-const std::string &LogContext::str()
+size_t LogStreamBuf::clamp(size_t n)
 {
-    if (_got_content)
+    if (!_limit || size() + n <= _limit)
     {
-        return _content;
+        return n;
     }
-    _content = std::ostringstream::str();
-    _got_content = true;
-    return _content;
+    size_t keep = _limit > size() ? _limit - size() : 0;
+    _truncated += n - keep;
+    return keep;
 }
 
-static std::string s_module_name = exeName(false);
-
-LogCapturer::LogCapturer(Logger &logger, LogLevel level, const char *file, const char *function, int line, const char *flag) : _ctx(new LogContext(level, file, function, line, s_module_name.c_str(), flag)), _logger(logger)
+void LogStreamBuf::shrink(size_t max_capacity)
 {
+    if (_capacity <= max_capacity)
+    {
+        return;
+    }
+    free(_buf);
+    _buf = nullptr;
+    _capacity = 0;
+    setp(nullptr, nullptr);
 }
 
-LogCapturer::LogCapturer(const LogCapturer &that) : _ctx(that._ctx), _logger(that._logger)
+const char *LogStreamBuf::data()
 {
-    const_cast<LogContextPtr &>(that._ctx).reset();
+    if (!_buf)
+    {
+        return "";
+    }
+    // 预留了结尾'\0'的空间，见grow()；已有结尾时不再写入，多个线程可同时读取写完的缓冲
+    if (*pptr() != '\0')
+    {
+        *pptr() = '\0';
+    }
+    return _buf;
 }
 
-LogCapturer::~LogCapturer()
+size_t LogStreamBuf::size() const
 {
-    (*this) << std::endl;
+    return pptr() - pbase();
 }
 
-LogCapturer &LogCapturer::operator<<(std::ostream &(*func)(std::ostream &))
+void LogStreamBuf::grow(size_t need)
 {
-    _logger.write(_ctx);
-    _ctx.reset();
-    return *this;
+    size_t size = this->size();
+    size_t capacity = _capacity ? _capacity * 2 : 128;
+    while (capacity < size + need)
+    {
+        capacity *= 2;
+    }
+    // 多分配一个字节用于结尾的'\0'
+    auto buf = (char *)realloc(_buf, capacity + 1);
+    if (!buf)
+    {
+        throw std::bad_alloc();
+    }
+    ++s_log_alloc_count;
+    _buf = buf;
+    _capacity = capacity;
+    setp(_buf, _buf + _capacity);
+    pbump((int)size);
 }
 
-///////////////////LogChannel///////////////////
-LogChannel::LogChannel(const std::string &name, LogLevel level) : _name(name), _level(level) {}
-
-LogChannel::~LogChannel() {}
+void LogStreamBuf::append(const void *data, size_t size)
+{
+    xsputn((const char *)data, size);
+}
 
-const std::string &LogChannel::name() const { return _name; }
+char *LogStreamBuf::prepare(size_t n)
+{
+    if ((size_t)(epptr() - pptr()) < n)
+    {
+        grow(n);
+    }
+    return pptr();
+}
 
-void LogChannel::setLevel(LogLevel level) { _level = level; }
+void LogStreamBuf::commit(size_t n)
+{
+    pbump((int)clamp(n));
+}
 
-std::string LogChannel::printTime(const timeval &tv)
+LogStreamBuf::int_type LogStreamBuf::overflow(int_type ch)
 {
-    auto tm = getLocalTime(tv.tv_sec);
-    char buf[128];
-    snprintf(buf, sizeof(buf), "%d-%02d-%02d %02d:%02d:%02d.%03d",
-             1900 + tm.tm_year,
-             1 + tm.tm_mon,
-             tm.tm_mday,
-             tm.tm_hour,
-             tm.tm_min,
-             tm.tm_sec,
-             (int)(tv.tv_usec / 1000));
-    return buf;
+    if (traits_type::eq_int_type(ch, traits_type::eof()))
+    {
+        return traits_type::not_eof(ch);
+    }
+    if (!clamp(1))
+    {
+        return ch;
+    }
+    if (pptr() == epptr())
+    {
+        grow(1);
+    }
+    *pptr() = traits_type::to_char_type(ch);
+    pbump(1);
+    return ch;
 }
 
-void LogChannel::format(const Logger &logger, std::ostream &ost, const LogContextPtr &ctx, bool enable_color,
-                        bool enable_detail)
+std::streamsize LogStreamBuf::xsputn(const char *s, std::streamsize n)
 {
-    if (!enable_detail && ctx->str().empty())
+    // 被截断的部分同样视为已写入，流不会因此进入错误状态
+    auto len = (std::streamsize)clamp(n);
+    if (epptr() - pptr() < len)
     {
-        // 没有任何信息打印
-        return;
+        grow(len);
     }
+    memcpy(pptr(), s, len);
+    pbump((int)len);
+    return n;
+}
 
-    if (enable_color)
+/**
+ * LogContext对象池
+ * 每个线程缓存少量空闲对象，超出或不足时与全局空闲链表批量交换
+ * 写线程释放的对象因此能以批次回到生产者线程，稳态下不再有堆分配
+ */
+class LogContextPool
+{
+public:
+    static LogContextPool &Instance()
     {
-#ifdef _WIN32
-        SetConsoleColor(LOG_CONST_TABLE[ctx->_level][1]);
-#else
-        ost << LOG_CONST_TABLE[ctx->_level][1];
-#endif
+        // 不析构，保证静态对象析构期间释放的日志仍可归还
+        static auto s_pool = new LogContextPool;
+        return *s_pool;
     }
 
-#ifdef _WIN32
-    ost << printTime(ctx->_tv) << " " << (char)LOG_CONST_TABLE[ctx->_level][2] << " ";
-#else
-    ost << printTime(ctx->_tv) << " " << LOG_CONST_TABLE[ctx->_level][2] << " ";
-#endif
+    LogContext *obtain()
+    {
+        auto &cache = localCache();
+        if (!cache.head)
+        {
+            cache.count = popBatch(cache.head);
+        }
+        if (!cache.head)
+        {
+            ++s_log_alloc_count;
+            return new LogContext;
+        }
+        auto ctx = cache.head;
+        cache.head = ctx->_next;
+        --cache.count;
+        ctx->_next = nullptr;
+        return ctx;
+    }
 
-    if (enable_detail)
+    void recycle(LogContext *ctx)
     {
-#if defined(_WIN32)
-        ost << (!ctx->_flag.empty() ? ctx->_flag : ctx->_module_name) << "[" << GetCurrentProcessId() << "-" << ctx->_thread_name;
-#else
-        ost << (!ctx->_flag.empty() ? ctx->_flag : logger.getName()) << "[" << getpid() << "-" << ctx->_thread_name;
-#endif
-        ost << "] " << ctx->_file << ":" << ctx->_line << " " << ctx->_function << " | ";
+        if (t_cache_destroyed)
+        {
+            // 线程退出阶段，直接归还全局链表
+            ctx->_next = nullptr;
+            pushBatch(ctx, ctx, 1);
+            return;
+        }
+        auto &cache = localCache();
+        ctx->_next = cache.head;
+        cache.head = ctx;
+        if (++cache.count >= s_batch * 2)
+        {
+            // 本线程缓存过多，归还一批至全局链表
+            auto first = cache.head;
+            auto last = first;
+            for (size_t i = 1; i < s_batch; ++i)
+            {
+                last = last->_next;
+            }
+            cache.head = last->_next;
+            cache.count -= s_batch;
+            last->_next = nullptr;
+            pushBatch(first, last, s_batch);
+        }
     }
 
-    ost << ctx->str();
+private:
+    struct LocalCache
+    {
+        LogContext *head = nullptr;
+        size_t count = 0;
+
+        ~LocalCache()
+        {
+            t_cache_destroyed = true;
+            if (!head)
+            {
+                return;
+            }
+            auto last = head;
+            while (last->_next)
+            {
+                last = last->_next;
+            }
+            LogContextPool::Instance().pushBatch(head, last, count);
+        }
+    };
 
-    if (enable_color)
+    static LocalCache &localCache()
     {
-#ifdef _WIN32
-        SetConsoleColor(CLEAR_COLOR);
-#else
-        ost << CLEAR_COLOR;
-#endif
+        static thread_local LocalCache s_cache;
+        return s_cache;
     }
 
-    if (ctx->_repeat > 1)
+    void pushBatch(LogContext *first, LogContext *last, size_t count)
     {
-        ost << "\r\n    Last message repeated " << ctx->_repeat << " times";
+        std::lock_guard<std::mutex> lck(_mtx);
+        last->_next = _head;
+        _head = first;
+        _count += count;
     }
-    ost << std::endl;
-}
 
-///////////////////FileChannelBase///////////////////
+    size_t popBatch(LogContext *&head)
+    {
+        std::lock_guard<std::mutex> lck(_mtx);
+        head = _head;
+        if (!head)
+        {
+            return 0;
+        }
+        size_t count = 1;
+        auto last = head;
+        while (count < s_batch && last->_next)
+        {
+            last = last->_next;
+            ++count;
+        }
+        _head = last->_next;
+        _count -= count;
+        last->_next = nullptr;
+        return count;
+    }
 
-FileChannelBase::FileChannelBase(const std::string &name, const std::string &path, LogLevel level) : LogChannel(name, level), _path(path) {}
+private:
+    static const size_t s_batch = 32;
+    static thread_local bool t_cache_destroyed;
+    std::mutex _mtx;
+    LogContext *_head = nullptr;
+    size_t _count = 0;
+};
 
-FileChannelBase::~FileChannelBase()
+thread_local bool LogContextPool::t_cache_destroyed = false;
+
+// 超过该大小的日志缓冲区不随对象回收，避免偶发的大日志长期占用内存
+static const size_t s_max_pooled_buffer = 64 * 1024;
+
+LogContext::LogContext() : std::ostream(nullptr)
 {
-    close();
+    rdbuf(&_sbuf);
 }
 
-void FileChannelBase::write(const Logger &logger, const LogContextPtr &ctx)
+void LogContext::reset()
 {
-    if (_level > ctx->_level)
+    // 恢复流的默认状态，防止上一条日志设置的格式(如std::hex)残留
+    clear();
+    flags(std::ios_base::dec | std::ios_base::skipws);
+    precision(6);
+    width(0);
+    fill(' ');
+    _sbuf.reset();
+    _args.reset();
+    _dropped_args = 0;
+    _deferred = false;
+    _repeat = 0;
+    _suppressed = 0;
+    for (auto &slot : _render_slots)
     {
-        return;
-    }
-    if (!_fstream.is_open())
-    {
-        open();
+        slot.valid.store(false, std::memory_order_relaxed);
+        slot.buf.reset();
     }
-    // 打印至文件，不启用颜色
-    format(logger, _fstream, ctx, false);
 }
 
-bool FileChannelBase::setPath(const std::string &path)
+LogContextPtr LogContext::create()
 {
-    _path = path;
-    return open();
+    auto ctx = LogContextPool::Instance().obtain();
+    ctx->reset();
+    ctx->_level = LTrace;
+    ctx->_site = &s_unknown_site;
+    ctx->_thread_name = "";
+    ctx->_thread_id = 0;
+    ctx->_tv = {0, 0};
+    return LogContextPtr(ctx);
 }
 
-const std::string &FileChannelBase::path() const
+LogContextPtr LogContext::create(const LogCallSite &site, LogLevel level)
 {
-    return _path;
+    auto ctx = LogContextPool::Instance().obtain();
+    ctx->reset();
+    ctx->_level = level;
+    ctx->_site = &site;
+    gettimeofday(&ctx->_tv, nullptr);
+    auto &thread = getThreadInfo();
+    ctx->_thread_name = thread.name;
+    ctx->_thread_id = thread.tid;
+    return LogContextPtr(ctx);
 }
 
-bool FileChannelBase::open()
+void LogContext::recycle(LogContext *ctx)
 {
-    // Ensure a path was set
-    if (_path.empty())
-    {
-        throw std::runtime_error("Log file _path is empty ,must be set");
-    }
-    // Open the file stream
-    _fstream.close();
-#if !defined(_WIN32)
-    // 创建文件夹
-    File::create_path(_path.data(), S_IRWXO | S_IRWXG | S_IRWXU);
-#else
-    File::create_path(_path.data(), 0);
-#endif
-    _fstream.open(_path.data(), std::ios::out | std::ios::app);
-    if (!_fstream.is_open())
+    ctx->_sbuf.shrink(s_max_pooled_buffer);
+    ctx->_args.shrink(s_max_pooled_buffer);
+    for (auto &slot : ctx->_render_slots)
     {
-        return false;
+        slot.buf.shrink(s_max_pooled_buffer);
     }
-    // 打开文件成功
-    return true;
+    LogContextPool::Instance().recycle(ctx);
 }
 
-void FileChannelBase::close()
+uint64_t LogContext::allocCount()
 {
-    _fstream.close();
+    return s_log_alloc_count.load(std::memory_order_relaxed);
 }
 
-size_t FileChannelBase::size()
+std::string_view LogContext::str()
 {
-    return (_fstream << std::flush).tellp();
+    if (_deferred)
+    {
+        renderArgs();
+        _deferred = false;
+    }
+    return std::string_view(_sbuf.data(), _sbuf.size());
 }
 
-///////////////////////////////LogFileChannel/////////////////////////
-LogFileChannel::LogFileChannel(const std::string &name, const std::string &dir, LogLevel level) : FileChannelBase(name, "", level)
+void LogContext::deferArg(LogArgType type, const void *data, size_t size)
 {
-    _dir = dir;
-    if (_dir.back() != '/')
+    // 参数不能截断，超出日志长度上限的参数整个丢弃
+    auto limit = _sbuf.limit();
+    if (limit && _args.size() + 1 + size > limit)
     {
-        _dir.append("/");
+        ++_dropped_args;
+        return;
     }
+    _args.append(&type, 1);
+    _args.append(data, size);
+}
 
-    // 收集所有日志文件
-    scanDir(_dir, [this](const std::string &path, bool isDir) -> bool
-            {
-        if (!isDir && end_with(path, ".log")) {
-            _log_file_map.emplace(path);
+void LogContext::deferString(const char *data, size_t size)
+{
+    auto limit = _sbuf.limit();
+    size_t head = 1 + sizeof(uint32_t);
+    if (limit && _args.size() + head + size > limit)
+    {
+        size_t keep = limit > _args.size() + head ? limit - _args.size() - head : 0;
+        _sbuf.discard(size - keep);
+        if (!keep)
+        {
+            return;
         }
-        return true; }, false);
+        size = keep;
+    }
+    uint32_t len = (uint32_t)size;
+    deferArg(LogArgString, &len, sizeof(len));
+    _args.append(data, len);
+}
 
-    // 获取今天日志文件的最大index号
-    auto log_name_prefix = getTimeStr("%Y-%m-%d_");
-    for (auto it = _log_file_map.begin(); it != _log_file_map.end(); ++it)
+// 读取一个参数并输出，剩余数据不足时返回false
+template <typename T>
+static bool renderArg(std::ostream &ost, const char *&ptr, const char *end)
+{
+    T value;
+    if ((size_t)(end - ptr) < sizeof(value))
     {
-        std::string name = getFileName(it->data());
-
-        // 筛选出今天所有的日志文件
+        return false;
+    }
+    memcpy(&value, ptr, sizeof(value));
+    ptr += sizeof(value);
+    ost << value;
+    return true;
+}
+
+void LogContext::renderArgs(std::ostream &ost, const char *data, size_t size, bool manipulators)
+{
+    using Manip = std::ios_base &(*)(std::ios_base &);
+    auto ptr = data;
+    auto end = data + size;
+    bool ok = true;
+    while (ok && ptr < end)
+    {
+        auto type = (LogArgType)*ptr++;
+        switch (type)
+        {
+        case LogArgBool: ok = renderArg<bool>(ost, ptr, end); break;
+        case LogArgChar: ok = renderArg<char>(ost, ptr, end); break;
+        case LogArgSChar: ok = renderArg<signed char>(ost, ptr, end); break;
+        case LogArgUChar: ok = renderArg<unsigned char>(ost, ptr, end); break;
+        case LogArgShort: ok = renderArg<short>(ost, ptr, end); break;
+        case LogArgUShort: ok = renderArg<unsigned short>(ost, ptr, end); break;
+        case LogArgInt: ok = renderArg<int>(ost, ptr, end); break;
+        case LogArgUInt: ok = renderArg<unsigned int>(ost, ptr, end); break;
+        case LogArgLong: ok = renderArg<long>(ost, ptr, end); break;
+        case LogArgULong: ok = renderArg<unsigned long>(ost, ptr, end); break;
+        case LogArgLongLong: ok = renderArg<long long>(ost, ptr, end); break;
+        case LogArgULongLong: ok = renderArg<unsigned long long>(ost, ptr, end); break;
+        case LogArgFloat: ok = renderArg<float>(ost, ptr, end); break;
+        case LogArgDouble: ok = renderArg<double>(ost, ptr, end); break;
+        case LogArgLongDouble: ok = renderArg<long double>(ost, ptr, end); break;
+        case LogArgPointer: ok = renderArg<const void *>(ost, ptr, end); break;
+        case LogArgManip:
+        {
+            Manip func;
+            ok = (size_t)(end - ptr) >= sizeof(func);
+            if (ok)
+            {
+                memcpy(&func, ptr, sizeof(func));
+                ptr += sizeof(func);
+                if (manipulators)
+                {
+                    ost << func;
+                }
+            }
+            break;
+        }
+        case LogArgString:
+        {
+            uint32_t len;
+            ok = (size_t)(end - ptr) >= sizeof(len);
+            if (ok)
+            {
+                memcpy(&len, ptr, sizeof(len));
+                ptr += sizeof(len);
+                // 截断的字符串输出已有的部分
+                len = (uint32_t)std::min<size_t>(len, end - ptr);
+                ost.write(ptr, len);
+                ptr += len;
+            }
+            break;
+        }
+        default:
+            // 不应出现的类型，停止渲染
+            ok = false;
+            break;
+        }
+    }
+}
+
+void LogContext::renderArgs()
+{
+    renderArgs(*this, (const char *)_args.data(), _args.size(), true);
+    _args.reset();
+}
+
+
+LogCapturer::LogCapturer(Logger &logger, const LogCallSite &site, LogLevel level) : _ctx(LogContext::create(site, level)), _logger(logger)
+{
+    _ctx->_deferred = logger.deferredFormat();
+    _ctx->buffer().setLimit(logger.maxRecordSize());
+}
+
+// 旧接口传入的调用位置，按文件、行号、函数与flag登记，进程内常驻
+struct RegisteredSite
+{
+    std::string file;
+    std::string function;
+    std::string flag;
+    LogCallSite site;
+};
+
+static const LogCallSite &registerSite(const char *file, const char *function, int line, const char *flag)
+{
+    static std::mutex s_mtx;
+    // 日志可能在静态对象析构期间打印，登记表不析构
+    static auto s_sites = new std::map<std::string, std::unique_ptr<RegisteredSite>>;
+    std::string key = std::string(file) + ':' + std::to_string(line) + ':' + function + ':' + flag;
+    std::lock_guard<std::mutex> lck(s_mtx);
+    auto &entry = (*s_sites)[key];
+    if (!entry)
+    {
+        entry.reset(new RegisteredSite{getFileName(file), logFunctionName(function), flag, {line, "", "", "", fnv1a(key.data(), key.size()), {0}}});
+        entry->site.file = entry->file.data();
+        entry->site.function = entry->function.data();
+        entry->site.flag = entry->flag.data();
+    }
+    return entry->site;
+}
+
+LogCapturer::LogCapturer(Logger &logger, LogLevel level, const char *file, const char *function, int line, const char *flag)
+    : LogCapturer(logger, registerSite(file, function, line, flag), level) {}
+
+LogCapturer::LogCapturer(const LogCapturer &that) : _ctx(that._ctx), _logger(that._logger)
+{
+    const_cast<LogContextPtr &>(that._ctx).reset();
+}
+
+LogCapturer::~LogCapturer()
+{
+    (*this) << std::endl;
+}
+
+LogCapturer &LogCapturer::operator<<(std::ostream &(*func)(std::ostream &))
+{
+    _logger.write(_ctx);
+    _ctx.reset();
+    return *this;
+}
+
+LogCapturer &LogCapturer::suppressed(uint64_t count)
+{
+    if (_ctx)
+    {
+        _ctx->_suppressed = count;
+    }
+    return *this;
+}
+
+///////////////////LogSiteLimiter///////////////////
+static uint64_t getCurrentMillisecond()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+bool LogSiteLimiter::everyN(uint64_t n)
+{
+    // 第1, n+1, 2n+1...次输出，每次输出前恰好抑制了n-1次
+    auto count = _count.fetch_add(1, std::memory_order_relaxed);
+    if (n <= 1 || count % n == 0)
+    {
+        if (count)
+        {
+            _suppressed.store(n > 1 ? n - 1 : 0, std::memory_order_relaxed);
+        }
+        return true;
+    }
+    return false;
+}
+
+bool LogSiteLimiter::everyMs(uint64_t ms)
+{
+    auto now = getCurrentMillisecond();
+    auto next = _next_ms.load(std::memory_order_relaxed);
+    // 多个线程同时到期时只有一个能输出
+    if (now >= next && _next_ms.compare_exchange_strong(next, now + ms, std::memory_order_relaxed))
+    {
+        return true;
+    }
+    _suppressed.fetch_add(1, std::memory_order_relaxed);
+    return false;
+}
+
+bool LogSiteLimiter::firstN(uint64_t n)
+{
+    // 达到n次后不再计数，避免热点路径上的原子写
+    if (_count.load(std::memory_order_relaxed) >= n)
+    {
+        return false;
+    }
+    return _count.fetch_add(1, std::memory_order_relaxed) < n;
+}
+
+bool LogSiteLimiter::sample(double rate)
+{
+    // 各线程独立的xorshift随机数，不共享状态
+    static thread_local uint64_t s_state = getThreadInfo().tid * 0x9E3779B97F4A7C15ULL | 1;
+    s_state ^= s_state << 13;
+    s_state ^= s_state >> 7;
+    s_state ^= s_state << 17;
+    if ((double)(s_state >> 11) * (1.0 / 9007199254740992.0) < rate)
+    {
+        return true;
+    }
+    _suppressed.fetch_add(1, std::memory_order_relaxed);
+    return false;
+}
+
+uint64_t LogSiteLimiter::takeSuppressed()
+{
+    if (!_suppressed.load(std::memory_order_relaxed))
+    {
+        return 0;
+    }
+    return _suppressed.exchange(0, std::memory_order_relaxed);
+}
+
+///////////////////LogChannel///////////////////
+LogChannel::LogChannel(const std::string &name, LogLevel level) : _name(name), _level(level) {}
+
+LogChannel::~LogChannel() {}
+
+const std::string &LogChannel::name() const { return _name; }
+
+void LogChannel::setLevel(LogLevel level)
+{
+    _level = level;
+    if (_logger)
+    {
+        _logger->updateLevel();
+    }
+}
+
+LogLevel LogChannel::getLevel() const { return _level; }
+
+std::string LogChannel::printTime(const timeval &tv)
+{
+    char buf[64];
+    auto len = printTime(tv, buf, sizeof(buf));
+    return std::string(buf, len);
+}
+
+size_t LogChannel::printTime(const timeval &tv, char *buf, size_t size, int precision)
+{
+    // 同一秒内的日志复用已格式化的"YYYY-MM-DD HH:MM:SS"前缀
+    struct TimeCache
+    {
+        time_t sec = -1;
+        size_t len = 0;
+        char prefix[32];
+    };
+    static thread_local TimeCache s_cache;
+
+    if (s_cache.sec != tv.tv_sec)
+    {
+        auto tm = getLocalTime(tv.tv_sec);
+        int len = snprintf(s_cache.prefix, sizeof(s_cache.prefix), "%d-%02d-%02d %02d:%02d:%02d",
+                           1900 + tm.tm_year,
+                           1 + tm.tm_mon,
+                           tm.tm_mday,
+                           tm.tm_hour,
+                           tm.tm_min,
+                           tm.tm_sec);
+        s_cache.len = len > 0 ? std::min<size_t>(len, sizeof(s_cache.prefix) - 1) : 0;
+        s_cache.sec = tv.tv_sec;
+    }
+
+    precision = std::max(0, std::min(precision, 6));
+    size_t total = s_cache.len + (precision ? precision + 1 : 0);
+    if (!size)
+    {
+        return 0;
+    }
+    if (total >= size)
+    {
+        // 缓冲区不足，截断
+        total = size - 1;
+    }
+    size_t prefix_len = std::min(s_cache.len, total);
+    memcpy(buf, s_cache.prefix, prefix_len);
+    if (total > prefix_len)
+    {
+        static const uint32_t s_div[] = {1000000, 100000, 10000, 1000, 100, 10, 1};
+        char frac[8];
+        frac[0] = '.';
+        auto value = (uint32_t)tv.tv_usec / s_div[precision];
+        for (int i = precision; i > 0; --i)
+        {
+            frac[i] = '0' + value % 10;
+            value /= 10;
+        }
+        memcpy(buf + prefix_len, frac, total - prefix_len);
+    }
+    buf[total] = '\0';
+    return total;
+}
+
+static void appendString(LogStreamBuf &buf, const char *str)
+{
+    buf.append(str, strlen(str));
+}
+
+template <typename T>
+static void appendNumber(LogStreamBuf &buf, T value)
+{
+    auto first = buf.prepare(24);
+    buf.commit(std::to_chars(first, first + 24, value).ptr - first);
+}
+
+LogRendered LogChannel::render(const Logger &logger, const LogContextPtr &ctx, bool enable_color, bool enable_detail)
+{
+    LogRendered ret;
+    ret.body = ctx->str();
+    if (!enable_detail && ret.body.empty())
+    {
+        // 没有任何信息打印
+        ret.body = std::string_view();
+        return ret;
+    }
+#ifdef _WIN32
+    // windows通过SetConsoleColor设置颜色，文本不含颜色控制字符
+    enable_color = false;
+#endif
+
+    auto &slot = ctx->_render_slots[(enable_color ? 1 : 0) | (enable_detail ? 2 : 0)];
+    if (!slot.valid.load(std::memory_order_acquire))
+    {
+        renderSlot(logger, ctx, slot, enable_color, enable_detail);
+    }
+    auto data = slot.buf.data();
+    ret.head = std::string_view(data, slot.head_end);
+    ret.tail = std::string_view(data + slot.head_end, slot.buf.size() - slot.head_end);
+    return ret;
+}
+
+void LogChannel::renderSlot(const Logger &logger, const LogContextPtr &ctx, LogContext::RenderSlot &slot, bool enable_color, bool enable_detail)
+{
+    std::lock_guard<std::mutex> lck(ctx->_render_mtx);
+    if (slot.valid.load(std::memory_order_relaxed))
+    {
+        return;
+    }
+    auto &buf = slot.buf;
+    buf.reset();
+#ifndef _WIN32
+    if (enable_color)
+    {
+        appendString(buf, LOG_CONST_TABLE[ctx->_level][1]);
+    }
+#endif
+    auto time_buf = buf.prepare(64);
+    buf.commit(printTime(ctx->_tv, time_buf, 64, logger.getTimePrecision()));
+#ifdef _WIN32
+    char level[] = {' ', (char)LOG_CONST_TABLE[ctx->_level][2], ' '};
+#else
+    char level[] = {' ', LOG_CONST_TABLE[ctx->_level][2][0], ' '};
+#endif
+    buf.append(level, sizeof(level));
+
+    if (enable_detail)
+    {
+        auto site = ctx->_site;
+#if defined(_WIN32)
+        auto name = *site->flag ? site->flag : s_module_name.c_str();
+        auto pid = GetCurrentProcessId();
+#else
+        auto name = *site->flag ? site->flag : logger.getName().c_str();
+        auto pid = getpid();
+#endif
+        appendString(buf, name);
+        buf.append("[", 1);
+        appendNumber(buf, pid);
+        buf.append("-", 1);
+        appendString(buf, ctx->_thread_name);
+        buf.append("] ", 2);
+        appendString(buf, site->file);
+        buf.append(":", 1);
+        appendNumber(buf, site->line);
+        buf.append(" ", 1);
+        appendString(buf, site->function);
+        buf.append(" | ", 3);
+    }
+    slot.head_end = (uint32_t)buf.size();
+
+    if (auto truncated = ctx->_sbuf.truncated())
+    {
+        appendString(buf, " ...[truncated ");
+        appendNumber(buf, truncated);
+        appendString(buf, " bytes]");
+    }
+    if (ctx->_dropped_args)
+    {
+        appendString(buf, " ...[dropped ");
+        appendNumber(buf, ctx->_dropped_args);
+        appendString(buf, " args]");
+    }
+    if (ctx->_suppressed)
+    {
+        appendString(buf, " [");
+        appendNumber(buf, ctx->_suppressed);
+        appendString(buf, " suppressed]");
+    }
+#ifndef _WIN32
+    if (enable_color)
+    {
+        appendString(buf, CLEAR_COLOR);
+    }
+#endif
+    if (ctx->_repeat > 1)
+    {
+        appendString(buf, "\r\n    Last message repeated ");
+        appendNumber(buf, ctx->_repeat);
+        appendString(buf, " times");
+    }
+    buf.append("\n", 1);
+    // 写入结尾'\0'，此后读取不再修改缓冲
+    buf.data();
+    slot.valid.store(true, std::memory_order_release);
+}
+
+void LogChannel::format(const Logger &logger, std::ostream &ost, const LogContextPtr &ctx, bool enable_color,
+                        bool enable_detail)
+{
+    auto rendered = render(logger, ctx, enable_color, enable_detail);
+    if (rendered.empty())
+    {
+        return;
+    }
+#ifdef _WIN32
+    if (enable_color)
+    {
+        SetConsoleColor(LOG_CONST_TABLE[ctx->_level][1]);
+    }
+#endif
+    ost.write(rendered.head.data(), rendered.head.size());
+    ost.write(rendered.body.data(), rendered.body.size());
+#ifdef _WIN32
+    if (enable_color)
+    {
+        SetConsoleColor(CLEAR_COLOR);
+    }
+#endif
+    ost.write(rendered.tail.data(), rendered.tail.size());
+    ost.flush();
+}
+
+///////////////////FileChannelBase///////////////////
+
+// 单次writev最多的数据块个数
+static const int s_max_iov = 1024;
+
+FileChannelBase::FileChannelBase(const std::string &name, const std::string &path, LogLevel level) : LogChannel(name, level), _path(path) {}
+
+FileChannelBase::~FileChannelBase()
+{
+    close();
+}
+
+void FileChannelBase::write(const Logger &logger, const LogContextPtr &ctx)
+{
+    if (_level > ctx->_level)
+    {
+        return;
+    }
+    if (_fd == -1 && !open())
+    {
+        return;
+    }
+    // 打印至文件，不启用颜色
+    auto rendered = render(logger, ctx, false);
+    if (rendered.empty())
+    {
+        return;
+    }
+    _file_size += rendered.size();
+
+    size_t copy_size = rendered.head.size() + rendered.tail.size();
+    if (!_buffer_size || copy_size > _buffer_size)
+    {
+        // 不缓存，立即写入
+        flush();
+        struct iovec iov[3] = {{(void *)rendered.head.data(), rendered.head.size()},
+                               {(void *)rendered.body.data(), rendered.body.size()},
+                               {(void *)rendered.tail.data(), rendered.tail.size()}};
+        writeOut(iov, 3, rendered.size());
+        return;
+    }
+
+    if (_arena_size != _buffer_size)
+    {
+        flush();
+        _arena.reset(new char[_buffer_size]);
+        _arena_size = _buffer_size;
+    }
+    if (_arena_size - _arena_used < copy_size || _iov.size() + 3 > (size_t)s_max_iov)
+    {
+        flush();
+    }
+
+    auto now = getCurrentMillisecond();
+    if (_iov.empty())
+    {
+        _first_pending_ms = now;
+    }
+    append(rendered.head.data(), rendered.head.size(), true);
+    if (!rendered.body.empty())
+    {
+        append(rendered.body.data(), rendered.body.size(), false);
+        _holding.emplace_back(ctx);
+    }
+    append(rendered.tail.data(), rendered.tail.size(), true);
+
+    if (_pending_bytes >= _buffer_size || now - _first_pending_ms >= _max_latency_ms)
+    {
+        flush();
+    }
+}
+
+void FileChannelBase::append(const char *data, size_t size, bool copy)
+{
+    if (!size)
+    {
+        return;
+    }
+    if (copy)
+    {
+        auto dst = _arena.get() + _arena_used;
+        memcpy(dst, data, size);
+        _arena_used += size;
+        if (!_iov.empty() && (char *)_iov.back().iov_base + _iov.back().iov_len == dst)
+        {
+            // 与上一块拷贝数据相邻，合并
+            _iov.back().iov_len += size;
+        }
+        else
+        {
+            _iov.push_back({dst, size});
+        }
+    }
+    else
+    {
+        _iov.push_back({(void *)data, size});
+    }
+    _pending_bytes += size;
+}
+
+void FileChannelBase::flush()
+{
+    if (_iov.empty())
+    {
+        return;
+    }
+    writeOut(_iov.data(), (int)_iov.size(), _pending_bytes);
+    _iov.clear();
+    _holding.clear();
+    _arena_used = 0;
+    _pending_bytes = 0;
+}
+
+bool FileChannelBase::writeOut(struct iovec *iov, int count, size_t bytes)
+{
+    if (_fd == -1)
+    {
+        return false;
+    }
+    while (count > 0)
+    {
+#if !defined(_WIN32)
+        auto n = ::writev(_fd, iov, std::min(count, s_max_iov));
+#else
+        auto n = ::_write(_fd, iov->iov_base, (unsigned int)iov->iov_len);
+#endif
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return false;
+        }
+        // 跳过已写入的数据块，处理部分写入
+        while (count > 0 && (size_t)n >= iov->iov_len)
+        {
+            n -= iov->iov_len;
+            ++iov;
+            --count;
+        }
+        if (count > 0)
+        {
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return true;
+}
+
+void FileChannelBase::setBufferSize(size_t size)
+{
+    flush();
+    _buffer_size = size;
+}
+
+void FileChannelBase::setMaxLatency(size_t ms)
+{
+    _max_latency_ms = ms;
+}
+
+bool FileChannelBase::setPath(const std::string &path)
+{
+    _path = path;
+    return open();
+}
+
+const std::string &FileChannelBase::path() const
+{
+    return _path;
+}
+
+bool FileChannelBase::open()
+{
+    // Ensure a path was set
+    if (_path.empty())
+    {
+        throw std::runtime_error("Log file _path is empty ,must be set");
+    }
+    // Close the previous file
+    close();
+    if (_adopt_fd != -1)
+    {
+        // 使用预先创建好的文件，不再创建目录与打开文件
+        _fd = _adopt_fd;
+        _adopt_fd = -1;
+        _file_size = 0;
+        return true;
+    }
+#if !defined(_WIN32)
+    // 创建文件夹
+    File::create_path(_path.data(), S_IRWXO | S_IRWXG | S_IRWXU);
+    _fd = ::open(_path.data(), (_open_rdwr ? O_RDWR : O_WRONLY) | O_CREAT | O_APPEND | O_CLOEXEC, 0666);
+#else
+    File::create_path(_path.data(), 0);
+    _fd = ::_open(_path.data(), _O_WRONLY | _O_CREAT | _O_APPEND | _O_BINARY, _S_IREAD | _S_IWRITE);
+#endif
+    if (_fd == -1)
+    {
+        return false;
+    }
+    struct stat st;
+    _file_size = fstat(_fd, &st) == 0 ? st.st_size : 0;
+    // 打开文件成功
+    return true;
+}
+
+void FileChannelBase::close()
+{
+    flush();
+    if (_fd != -1)
+    {
+        closeFd(_fd);
+        _fd = -1;
+    }
+}
+
+void FileChannelBase::closeFd(int fd)
+{
+#if !defined(_WIN32)
+    ::close(fd);
+#else
+    ::_close(fd);
+#endif
+}
+
+size_t FileChannelBase::size()
+{
+    return _file_size;
+}
+
+///////////////////////////////LogFileChannel/////////////////////////
+/**
+ * 文件通道的后台维护线程，负责预先创建切片、关闭与改名、删除过期切片
+ * 进程退出时可能仍有任务未执行，对象不析构
+ */
+static TaskQueueThread &housekeeper()
+{
+    static TaskQueueThread *s_thread = new TaskQueueThread("log housekeep");
+    return *s_thread;
+}
+
+struct LogFileChannel::NextFile
+{
+    std::mutex mtx;
+    // 通道已析构，后台线程创建的文件应删除
+    bool closed = false;
+    bool preparing = false;
+    int fd = -1;
+    std::string path;
+};
+
+// 在后台线程中删除已退出进程预创建的下一个切片(.next_<pid>_<seq>.tmp)，进程崩溃时它们不会被删除
+// 切片在写入前已同步改名为.log，遗留的.tmp文件都是未被使用的空文件
+static void removeStaleNextFiles(const std::string &dir)
+{
+#if !defined(_WIN32)
+    housekeeper().post([dir]()
+                       {
+        DIR *pDir = opendir(dir.data());
+        if (!pDir) {
+            return;
+        }
+        dirent *pDirent;
+        while ((pDirent = readdir(pDir)) != nullptr) {
+            int pid = 0;
+            if (!start_with(pDirent->d_name, ".next_") || !end_with(pDirent->d_name, ".tmp") ||
+                sscanf(pDirent->d_name, ".next_%d_", &pid) != 1 || pid <= 0 || pid == getpid()) {
+                continue;
+            }
+            // EPERM说明进程存在但属于其他用户
+            if (kill((pid_t)pid, 0) == -1 && errno == ESRCH) {
+                unlink((dir + pDirent->d_name).data());
+            }
+        }
+        closedir(pDir); });
+#endif
+}
+
+LogFileChannel::LogFileChannel(const std::string &name, const std::string &dir, LogLevel level) : FileChannelBase(name, "", level), _next(std::make_shared<NextFile>())
+{
+    _dir = dir;
+    if (_dir.back() != '/')
+    {
+        _dir.append("/");
+    }
+
+    // 收集所有日志文件
+    scanDir(_dir, [this](const std::string &path, bool isDir) -> bool
+            {
+        if (!isDir && end_with(path, ".log")) {
+            _log_file_map.emplace(path);
+        } else if (!isDir && end_with(path, ".log.gz")) {
+            _log_file_map.emplace(path.substr(0, path.size() - 3));
+        }
+        return true; }, false);
+    removeStaleNextFiles(_dir);
+
+    // 获取今天日志文件的最大index号
+    auto log_name_prefix = getTimeStr("%Y-%m-%d_");
+    for (auto it = _log_file_map.begin(); it != _log_file_map.end(); ++it)
+    {
+        std::string name = getFileName(it->data());
+
+        // 筛选出今天所有的日志文件
         if (start_with(name, log_name_prefix))
         {
-            int tm_mday; // day of the month - [1, 31]
-            int tm_mon;  // months since January - [0, 11]
-            int tm_year; // years since 1900
-            int tm_time;
-            uint32_t index = 0;
-            // 今天第几个文件
+            int tm_mday; // day of the month - [1, 31]
+            int tm_mon;  // months since January - [0, 11]
+            int tm_year; // years since 1900
+            int tm_time;
+            uint32_t index = 0;
+            // 今天第几个文件
+
+            int count = sscanf(name.c_str(), "%d-%d-%d_%d_%u.log", &tm_year, &tm_mon, &tm_mday, &tm_time, &index);
+
+            if (count == 5)
+            {
+                _index = index >= _index ? index : _index;
+            }
+        }
+    }
+}
+
+// 在后台线程中删除切片及其压缩文件，包括进程退出时未压缩完的临时文件
+static void deleteLogFile(const std::string &path)
+{
+    housekeeper().post([path]()
+                       {
+        File::delete_file(path.data());
+        File::delete_file((path + ".gz").data());
+        File::delete_file((path + ".gz.tmp").data()); });
+}
+
+LogFileChannel::~LogFileChannel()
+{
+    std::lock_guard<std::mutex> lck(_next->mtx);
+    _next->closed = true;
+    if (_next->fd != -1)
+    {
+        closeFd(_next->fd);
+        File::delete_file(_next->path.data());
+        _next->fd = -1;
+    }
+}
+
+void LogFileChannel::clean()
+{
+    auto today = getDay(time(nullptr));
+    for (auto it = _log_file_map.begin(); it != _log_file_map.end();)
+    {
+        auto day = getDay(getLogFileTime(it->c_str()));
+        if (today < day + _log_max_day || *it == _path)
+        {
+            break;
+        }
+        // 删除过期文件
+        deleteLogFile(*it);
+        // 删除这条记录
+        it = _log_file_map.erase(it);
+    }
+
+    // 按文件个数清理，限制最大文件切片个数
+    while (_log_file_map.size() > _log_max_count)
+    {
+        auto it = _log_file_map.begin();
+        if (*it == _path)
+        {
+            // 当前文件，停止删除
+            break;
+        }
+        // 删除文件
+        deleteLogFile(*it);
+        // 删除这条记录
+        _log_file_map.erase(it);
+    }
+}
+
+void LogFileChannel::changeFile(time_t second)
+{
+    // 同一秒内多次切片时靠序号区分文件名
+    std::string logFile = _dir + getTimeStr("%Y-%m-%d_%H%M%S_", second) + std::to_string(++_index) + ".log";
+    _log_file_map.emplace(logFile);
+    auto old_path = std::move(_path);
+    _path = logFile;
+    {
+        std::lock_guard<std::mutex> lck(_next->mtx);
+        if (_next->fd != -1)
+        {
+            // 切片只需替换文件描述符；写入前同步改名，进程随后退出或崩溃也不会把数据留在.tmp文件中
+            if (rename(_next->path.data(), logFile.data()) == 0)
+            {
+                _adopt_fd = _next->fd;
+            }
+            else
+            {
+                closeFd(_next->fd);
+                File::delete_file(_next->path.data());
+            }
+            _next->fd = -1;
+        }
+    }
+    _rotating = true;
+    _can_write = open();
+    _rotating = false;
+    if (!_can_write)
+    {
+        ErrorL << "Failed to open log file: " << _path;
+    }
+    if (_compress)
+    {
+        if (!_compress_scanned)
+        {
+            // 之前运行遗留的未压缩切片
+            _compress_scanned = true;
+            for (auto &path : _log_file_map)
+            {
+                if (path != _path && path != old_path && File::fileExist(path.data()))
+                {
+                    compressFile(path);
+                }
+            }
+        }
+        if (!old_path.empty() && old_path != _path)
+        {
+            compressFile(old_path);
+        }
+    }
+    clean();
+    prepareNext();
+}
+
+void LogFileChannel::prepareNext()
+{
+#if !defined(_WIN32)
+    {
+        std::lock_guard<std::mutex> lck(_next->mtx);
+        if (_next->preparing || _next->fd != -1)
+        {
+            return;
+        }
+        _next->preparing = true;
+    }
+    auto next = _next;
+    auto dir = _dir;
+    int flags = (_open_rdwr ? O_RDWR : O_WRONLY) | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC;
+    housekeeper().post([next, dir, flags]()
+                       {
+        static uint64_t s_seq = 0;
+        File::create_path(dir.data(), S_IRWXO | S_IRWXG | S_IRWXU);
+        // 隐藏文件且不以.log结尾，扫描切片时会被忽略
+        auto path = dir + ".next_" + std::to_string(getpid()) + "_" + std::to_string(++s_seq) + ".tmp";
+        int fd = ::open(path.data(), flags, 0666);
+        std::lock_guard<std::mutex> lck(next->mtx);
+        next->preparing = false;
+        if (fd == -1) {
+            return;
+        }
+        if (next->closed) {
+            ::close(fd);
+            unlink(path.data());
+            return;
+        }
+        next->fd = fd;
+        next->path = std::move(path); });
+#endif
+}
+
+void LogFileChannel::closeFd(int fd)
+{
+#if !defined(_WIN32)
+    if (_rotating)
+    {
+        // 关闭旧切片可能触发回写，交给后台线程
+        housekeeper().post([fd]()
+                           { ::close(fd); });
+        return;
+    }
+#endif
+    FileChannelBase::closeFd(fd);
+}
+
+struct LogFileChannel::CompressReport
+{
+    std::mutex mtx;
+    std::vector<std::string> lines;
+    std::atomic<bool> pending{false};
+};
+
+void LogFileChannel::setCompress(bool enable)
+{
+    _compress = enable && LogCompressor::available();
+    if (_compress && !_compress_report)
+    {
+        _compress_report = std::make_shared<CompressReport>();
+    }
+}
+
+void LogFileChannel::compressFile(const std::string &path)
+{
+    // 压缩线程只持有统计结果，通道析构后回调依然安全
+    auto report = _compress_report;
+    LogCompressor::onResult cb = [report](const LogCompressor::Result &result)
+    {
+        if (!result.success)
+        {
+            return;
+        }
+        char line[512];
+        snprintf(line, sizeof(line), "compressed %s: %zu -> %zu bytes (%.1f%%), cpu %.1f ms",
+                 getFileName(result.path.data()), result.input_bytes, result.output_bytes,
+                 result.input_bytes ? result.output_bytes * 100.0 / result.input_bytes : 0.0, result.cpu_us / 1000.0);
+        std::lock_guard<std::mutex> lck(report->mtx);
+        report->lines.emplace_back(line);
+        report->pending = true;
+    };
+    // 经后台线程转交，保证旧切片已关闭、已改名后才开始压缩
+    housekeeper().post([path, cb]()
+                       { LogCompressor::Instance().compress(path, cb); });
+}
+
+void LogFileChannel::writeCompressReport(const Logger &logger)
+{
+    std::vector<std::string> lines;
+    {
+        std::lock_guard<std::mutex> lck(_compress_report->mtx);
+        lines.swap(_compress_report->lines);
+        _compress_report->pending = false;
+    }
+    for (auto &line : lines)
+    {
+        static constexpr auto s_site = LOG_CALL_SITE("");
+        auto ctx = LogContext::create(s_site, LInfo);
+        *ctx << line;
+        FileChannelBase::write(logger, ctx);
+    }
+}
+
+void LogFileChannel::checkSize(time_t second, const Logger &logger, const LogContextPtr &ctx)
+{
+    // 文件大小按写入字节精确累计，不需要访问文件；空切片放不下时不再切片
+    auto size = FileChannelBase::size();
+    if (size > maxFileSize() || (size && wouldOverflow(logger, ctx)))
+    {
+        changeFile(second);
+    }
+}
+
+bool LogFileChannel::wouldOverflow(const Logger &, const LogContextPtr &)
+{
+    return false;
+}
+
+void LogFileChannel::write(const Logger &logger, const LogContextPtr &logContext)
+{
+    time_t second = logContext->_tv.tv_sec;
+    int64_t day = getDay(second);
+    if (day != _last_day)
+    {
+        if (_last_day != -1)
+        {
+            _index = 0;
+        }
+        _last_day = day;
+        changeFile(second);
+    }
+    else
+    {
+        checkSize(second, logger, logContext);
+    }
+    if (_can_write)
+    {
+        FileChannelBase::write(logger, logContext);
+        if (_compress_report && _compress_report->pending.load(std::memory_order_relaxed))
+        {
+            writeCompressReport(logger);
+        }
+    }
+}
+
+void LogFileChannel::setMaxDay(size_t max_day)
+{
+    _log_max_day = max_day > 1 ? max_day : 1;
+}
+
+void LogFileChannel::setFileMaxSize(size_t max_size)
+{
+    _log_max_size = max_size > 1 ? max_size : 1;
+}
+
+void LogFileChannel::setFileMaxCount(size_t max_count)
+{
+    _log_max_count = max_count > 1 ? max_count : 1;
+}
+
+size_t LogFileChannel::maxFileSize() const
+{
+    return _log_max_size * 1024 * 1024;
+}
+
+///////////////////////////////LogMmapFileChannel/////////////////////////
+LogMmapFileChannel::LogMmapFileChannel(const std::string &name, const std::string &dir, LogLevel level) : LogFileChannel(name, dir, level)
+{
+    // 日志直接拷贝进映射区，不需要再经过写缓冲
+    setBufferSize(0);
+    _open_rdwr = true;
+}
+
+LogMmapFileChannel::~LogMmapFileChannel()
+{
+    // 基类析构时已无法调用本类的close
+    close();
+}
+
+bool LogMmapFileChannel::open()
+{
+    // 基类open会先调用close，截断并解除旧切片的映射
+    if (!FileChannelBase::open())
+    {
+        return false;
+    }
+    _map_used = _file_size;
+    map(std::max(maxFileSize(), _map_used));
+    return true;
+}
+
+void LogMmapFileChannel::close()
+{
+    FileChannelBase::flush();
+    if (_map)
+    {
+        unmap();
+        if (_fd != -1 && ftruncate(_fd, _map_used) != 0)
+        {
+            std::cerr << "Failed to truncate log file: " << _path << std::endl;
+        }
+    }
+    FileChannelBase::close();
+}
+
+bool LogMmapFileChannel::map(size_t size)
+{
+#if !defined(_WIN32)
+    unmap();
+    if (_fd == -1)
+    {
+        return false;
+    }
+#if defined(__linux__)
+    // 预分配磁盘空间，文件系统不支持时退化为稀疏文件
+    if (fallocate(_fd, 0, 0, size) != 0 && ftruncate(_fd, size) != 0)
+#else
+    if (ftruncate(_fd, size) != 0)
+#endif
+    {
+        return false;
+    }
+    auto ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+    if (ptr == MAP_FAILED)
+    {
+        // 映射失败，恢复文件长度后退化为普通写入
+        if (ftruncate(_fd, _map_used) != 0)
+        {
+            std::cerr << "Failed to truncate log file: " << _path << std::endl;
+        }
+        return false;
+    }
+    _map = (char *)ptr;
+    _map_size = size;
+    return true;
+#else
+    return false;
+#endif
+}
+
+void LogMmapFileChannel::unmap()
+{
+#if !defined(_WIN32)
+    if (_map)
+    {
+        munmap(_map, _map_size);
+        _map = nullptr;
+        _map_size = 0;
+    }
+#endif
+}
+
+bool LogMmapFileChannel::wouldOverflow(const Logger &logger, const LogContextPtr &ctx)
+{
+    if (!_map || _level > ctx->_level)
+    {
+        return false;
+    }
+    // 渲染结果缓存在日志中，随后写入时不再重复渲染
+    return _map_used + render(logger, ctx, false).size() > _map_size;
+}
+
+bool LogMmapFileChannel::writeOut(struct iovec *iov, int count, size_t bytes)
+{
+    // 切片已在写入前完成，仍放不下说明单条日志超过切片大小，扩大映射
+    if (_map && _map_used + bytes > _map_size && !map(_map_used + bytes))
+    {
+        std::cerr << "Failed to map log file: " << _path << std::endl;
+    }
+    if (!_map)
+    {
+        return FileChannelBase::writeOut(iov, count, bytes);
+    }
+    auto dst = _map + _map_used;
+    for (int i = 0; i < count; ++i)
+    {
+        memcpy(dst, iov[i].iov_base, iov[i].iov_len);
+        dst += iov[i].iov_len;
+    }
+    _map_used += bytes;
+    return true;
+}
+
+///////////////////ConsoleChannel///////////////////
+LogConsoleChannel::LogConsoleChannel(const std::string &name, LogLevel level) : LogChannel(name, level)
+{
+}
+
+void LogConsoleChannel::write(const Logger &logger, const LogContextPtr &ctx)
+{
+    if (_level > ctx->_level)
+    {
+        return;
+    }
+
+#if defined(OS_IPHONE)
+    // ios禁用日志颜色
+    format(logger, std::cout, ctx, false);
+#elif defined(ANDROID)
+    static android_LogPriority LogPriorityArr[10];
+    static onceToken s_token([]()
+                             {
+        LogPriorityArr[LTrace] = ANDROID_LOG_VERBOSE;
+        LogPriorityArr[LDebug] = ANDROID_LOG_DEBUG;
+        LogPriorityArr[LInfo] = ANDROID_LOG_INFO;
+        LogPriorityArr[LWarn] = ANDROID_LOG_WARN;
+        LogPriorityArr[LError] = ANDROID_LOG_ERROR; });
+    __android_log_print(LogPriorityArr[ctx->_level], "JNI", "%s %s", ctx->_site->function, ctx->str().data());
+#else
+    // linux/windows日志启用颜色并显示日志详情
+    format(logger, std::cout, ctx);
+#endif
+}
+
+///////////////////LogAsyncChannel///////////////////
+static uint64_t getCurrentNanosecond()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static LogLevel minLevel(const std::vector<std::shared_ptr<LogChannel>> &channels)
+{
+    int level = LError;
+    for (auto &chn : channels)
+    {
+        level = std::min<int>(level, chn->getLevel());
+    }
+    return (LogLevel)level;
+}
+
+LogAsyncChannel::LogAsyncChannel(const std::string &name, std::vector<std::shared_ptr<LogChannel>> channels, size_t capacity)
+    : LogChannel(name, minLevel(channels)), _channels(std::move(channels)), _queue(capacity)
+{
+    _thread = std::thread(&LogAsyncChannel::run, this);
+}
+
+LogAsyncChannel::LogAsyncChannel(const std::shared_ptr<LogChannel> &channel, size_t capacity)
+    : LogAsyncChannel(channel->name(), {channel}, capacity) {}
 
-            int count = sscanf(name.c_str(), "%d-%d-%d_%d_%u.log", &tm_year, &tm_mon, &tm_mday, &tm_time, &index);
+LogAsyncChannel::~LogAsyncChannel()
+{
+    _exit = true;
+    _sem.post();
+    _thread.join();
+    // 退出前写完剩余日志
+    consume();
+}
 
-            if (count == 5)
-            {
-                _index = index >= _index ? index : _index;
-            }
-        }
+void LogAsyncChannel::write(const Logger &logger, const LogContextPtr &ctx)
+{
+    if (_level > ctx->_level)
+    {
+        return;
+    }
+    // 在本线程完成延迟格式化，之后日志内容只读，可被多个通道线程同时访问
+    ctx->str();
+    Item item;
+    item.ctx = ctx;
+    item.logger = &logger;
+    item.enqueue_ns = getCurrentNanosecond();
+    if (!_queue.tryPush(std::move(item)))
+    {
+        _dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    // 唤醒协议同LogAsyncWriter
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (_sleeping.load(std::memory_order_relaxed) && _sleeping.exchange(false))
+    {
+        _sem.post();
     }
 }
 
-void LogFileChannel::clean()
+bool LogAsyncChannel::consume()
 {
-    auto today = getDay(time(nullptr));
-    for (auto it = _log_file_map.begin(); it != _log_file_map.end(); ++it)
+    bool consumed = false;
+    while (_queue.popBatch([this](Item &item)
+                           {
+        for (auto &chn : _channels) {
+            chn->write(*item.logger, item.ctx);
+        }
+        auto lag = getCurrentNanosecond() - item.enqueue_ns;
+        _total_lag_ns.fetch_add(lag, std::memory_order_relaxed);
+        if (lag > _max_lag_ns.load(std::memory_order_relaxed)) {
+            _max_lag_ns.store(lag, std::memory_order_relaxed);
+        }
+        _written.fetch_add(1, std::memory_order_relaxed); },
+                           s_flush_batch))
     {
-        auto day = getDay(getLogFileTime(it->c_str()));
-        if (today < day + _log_max_day)
+        consumed = true;
+    }
+    if (consumed)
+    {
+        for (auto &chn : _channels)
         {
-            break;
+            chn->flush();
         }
-        (it->data());
-        // 删除这条记录
-        it = _log_file_map.erase(it);
     }
+    return consumed;
+}
 
-    // 按文件个数清理，限制最大文件切片个数
-    while (_log_file_map.size() > _log_max_count)
+void LogAsyncChannel::run()
+{
+    setThreadName(("async " + _name).data());
+    while (!_exit)
     {
-        auto it = _log_file_map.begin();
-        if (*it == _path)
+        consume();
+        _sleeping = true;
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (!_queue.empty())
         {
-            // 当前文件，停止删除
-            break;
+            _sleeping = false;
+            continue;
         }
-        // 删除文件
-        File::delete_file(it->data());
-        // 删除这条记录
-        _log_file_map.erase(it);
+        _sem.wait();
+        _sleeping = false;
     }
 }
 
-void LogFileChannel::changeFile(time_t second)
+LogAsyncChannel::Stats LogAsyncChannel::stats() const
 {
-    std::string logFile = _dir + getTimeStr("%Y-%m-%d_%H%M%S_", second) + std::to_string(_index + 1) + ".log";
-    _log_file_map.emplace(logFile);
-    _path = logFile;
-    _can_write = open();
-    if (!_can_write)
+    Stats ret;
+    ret.written = _written.load(std::memory_order_relaxed);
+    ret.dropped = _dropped.load(std::memory_order_relaxed);
+    ret.max_lag_us = _max_lag_ns.load(std::memory_order_relaxed) / 1000;
+    ret.avg_lag_us = ret.written ? _total_lag_ns.load(std::memory_order_relaxed) / ret.written / 1000 : 0;
+    ret.queued = _queue.size();
+    return ret;
+}
+
+///////////////////ModuleLevel///////////////////
+std::atomic<uint32_t> g_moduleLevelGeneration(0);
+
+// 按文件或flag配置的日志等级规则
+struct ModuleLevelRules
+{
+    std::mutex mtx;
+    std::vector<std::pair<std::string, LogLevel>> rules;
+    // 单调递增的配置版本号，只保留24位
+    uint32_t version = 0;
+
+    static ModuleLevelRules &Instance()
     {
-        ErrorL << "Failed to open log file: " << _path;
+        // 静态对象析构后仍可能有日志，对象不析构
+        static ModuleLevelRules *s_instance = new ModuleLevelRules;
+        return *s_instance;
     }
-    clean();
-}
 
-void LogFileChannel::checkSize(time_t second)
+    // 规则变化后调用，须持有锁
+    void publish()
+    {
+        version = (version + 1) & 0xffffff;
+        if (!version)
+        {
+            version = 1;
+        }
+        g_moduleLevelGeneration.store(rules.empty() ? 0 : version, std::memory_order_relaxed);
+    }
+};
+
+// 支持*与?的通配匹配
+static bool globMatch(const char *pattern, const char *str)
 {
-    // 每60秒检查一下文件大小，防止频繁flush日志文件
-    if (second - _last_check_time > 60)
+    const char *star = nullptr;
+    const char *resume = nullptr;
+    while (*str)
     {
-        if (FileChannelBase::size() > _log_max_size * 1024 * 1024)
+        if (*pattern == '*')
+        {
+            star = pattern++;
+            resume = str;
+        }
+        else if (*pattern == '?' || *pattern == *str)
+        {
+            ++pattern;
+            ++str;
+        }
+        else if (star)
+        {
+            pattern = star + 1;
+            str = ++resume;
+        }
+        else
         {
-            changeFile(second);
+            return false;
         }
-        _last_check_time = second;
     }
+    while (*pattern == '*')
+    {
+        ++pattern;
+    }
+    return !*pattern;
 }
 
-void LogFileChannel::write(const Logger &logger, const LogContextPtr &logContext)
+static bool parseLevel(std::string str, LogLevel &level)
 {
-    time_t second = logContext->_tv.tv_sec;
-    int64_t day = getDay(second);
-    if (day != _last_day)
+    static const char *s_names[] = {"trace", "debug", "info", "warn", "error"};
+    std::transform(str.begin(), str.end(), str.begin(), ::tolower);
+    for (int i = LTrace; i <= LError; ++i)
     {
-        if (_last_day != -1)
+        if (str == s_names[i] || str == std::to_string(i))
         {
-            _index = 0;
+            level = (LogLevel)i;
+            return true;
         }
-        _last_day = day;
-        changeFile(second);
     }
-    else
+    return false;
+}
+
+int resolveModuleLevel(const LogCallSite &site)
+{
+    auto &rules = ModuleLevelRules::Instance();
+    std::lock_guard<std::mutex> lck(rules.mtx);
+    int level = LOG_LEVEL_UNSET;
+    std::string stem = site.file;
+    stem = stem.substr(0, stem.find('.'));
+    for (auto &rule : rules.rules)
     {
-        checkSize(second);
+        auto pattern = rule.first.data();
+        if (globMatch(pattern, site.file) || globMatch(pattern, stem.data()) || (*site.flag && globMatch(pattern, site.flag)))
+        {
+            level = rule.second;
+            break;
+        }
     }
-    if (_can_write)
+    // 在锁内读取版本号，保证缓存的等级与版本号对应
+    site.module_level.store(g_moduleLevelGeneration.load(std::memory_order_relaxed) << 8 | level, std::memory_order_relaxed);
+    return level;
+}
+
+bool Logger::setModuleLevels(const std::string &spec)
+{
+    std::vector<std::pair<std::string, LogLevel>> parsed;
+    for (auto &item : split(spec, ","))
     {
-        FileChannelBase::write(logger, logContext);
+        if (item.empty())
+        {
+            continue;
+        }
+        auto pos = item.find('=');
+        LogLevel level;
+        if (pos == std::string::npos || !pos || !parseLevel(item.substr(pos + 1), level))
+        {
+            return false;
+        }
+        parsed.emplace_back(item.substr(0, pos), level);
     }
+    auto &rules = ModuleLevelRules::Instance();
+    std::lock_guard<std::mutex> lck(rules.mtx);
+    rules.rules.swap(parsed);
+    rules.publish();
+    return true;
 }
 
-void LogFileChannel::setMaxDay(size_t max_day)
+void Logger::setModuleLevel(const std::string &pattern, LogLevel level)
 {
-    _log_max_day = max_day > 1 ? max_day : 1;
+    auto &rules = ModuleLevelRules::Instance();
+    std::lock_guard<std::mutex> lck(rules.mtx);
+    auto it = std::find_if(rules.rules.begin(), rules.rules.end(), [&](const std::pair<std::string, LogLevel> &rule)
+                           { return rule.first == pattern; });
+    if (it != rules.rules.end())
+    {
+        it->second = level;
+    }
+    else
+    {
+        rules.rules.emplace_back(pattern, level);
+    }
+    rules.publish();
 }
 
-void LogFileChannel::setFileMaxSize(size_t max_size)
+void Logger::clearModuleLevels()
 {
-    _log_max_size = max_size > 1 ? max_size : 1;
+    auto &rules = ModuleLevelRules::Instance();
+    std::lock_guard<std::mutex> lck(rules.mtx);
+    rules.rules.clear();
+    rules.publish();
 }
 
-void LogFileChannel::setFileMaxCount(size_t max_count)
+///////////////////ScopedLogLevel///////////////////
+std::atomic<int> g_threadLevelOverrides(0);
+thread_local int t_threadLevelOverride = LOG_LEVEL_UNSET;
+
+ScopedLogLevel::ScopedLogLevel(int level) : _previous(t_threadLevelOverride)
 {
-    _log_max_count = max_count > 1 ? max_count : 1;
+    // 清除覆盖的作用域也计数，计数只用于跳过线程局部变量的读取
+    t_threadLevelOverride = level;
+    g_threadLevelOverrides.fetch_add(1, std::memory_order_relaxed);
 }
 
-///////////////////ConsoleChannel///////////////////
-LogConsoleChannel::LogConsoleChannel(const std::string &name, LogLevel level) : LogChannel(name, level)
+ScopedLogLevel::~ScopedLogLevel()
 {
+    t_threadLevelOverride = _previous;
+    g_threadLevelOverrides.fetch_sub(1, std::memory_order_relaxed);
 }
 
-void LogConsoleChannel::write(const Logger &logger, const LogContextPtr &ctx)
+int ScopedLogLevel::current()
 {
-    if (_level > ctx->_level)
-    {
-        return;
-    }
-
-#if defined(OS_IPHONE)
-    // ios禁用日志颜色
-    format(logger, std::cout, ctx, false);
-#elif defined(ANDROID)
-    static android_LogPriority LogPriorityArr[10];
-    static onceToken s_token([]()
-                             {
-        LogPriorityArr[LTrace] = ANDROID_LOG_VERBOSE;
-        LogPriorityArr[LDebug] = ANDROID_LOG_DEBUG;
-        LogPriorityArr[LInfo] = ANDROID_LOG_INFO;
-        LogPriorityArr[LWarn] = ANDROID_LOG_WARN;
-        LogPriorityArr[LError] = ANDROID_LOG_ERROR; });
-    __android_log_print(LogPriorityArr[ctx->_level], "JNI", "%s %s", ctx->_function.data(), ctx->str().data());
-#else
-    // linux/windows日志启用颜色并显示日志详情
-    format(logger, std::cout, ctx);
-#endif
+    return t_threadLevelOverride;
 }
 
-Logger::Logger(const std::string &loggerName)
+///////////////////Logger///////////////////
+Logger::Logger(const std::string &loggerName) : _min_level(LError + 1), _channel_level(LError + 1)
 {
     _logger_name = loggerName;
-    _channels.clear();
-    _last_log = std::make_shared<LogContext>();
+    _channels = std::make_shared<ChannelList>();
+    _channels_snapshot = _channels;
 }
 Logger::~Logger()
 {
+    if (_repeat_timer.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> lck(_sync_mtx);
+            _repeat_timer_exit = true;
+        }
+        _repeat_cond.notify_one();
+        _repeat_timer.join();
+    }
     _writer.reset();
+    flushRepeats({0, 0}, true);
     /*{
         LogContextCapture(*this, LInfo, __FILE__, __FUNCTION__, __LINE__);
     }*/
-    _channels.clear();
+    std::lock_guard<std::mutex> lck(_channel_mtx);
+    for (auto &chn : *_channels)
+    {
+        if (chn->_logger == this)
+        {
+            chn->_logger = nullptr;
+        }
+    }
+    publishChannels({});
 }
 
 /*Logger &Logger::Instance()
@@ -493,12 +2227,62 @@ INSTANCE_IMP(Logger, exeName())
 
 void Logger::add_channel(const std::shared_ptr<LogChannel> &channel)
 {
-    _channels[channel->name()] = channel;
+    {
+        std::lock_guard<std::mutex> lck(_channel_mtx);
+        channel->_logger = this;
+        auto channels = *_channels;
+        auto it = std::find_if(channels.begin(), channels.end(), [&](const std::shared_ptr<LogChannel> &chn)
+                               { return chn->name() == channel->name(); });
+        if (it != channels.end())
+        {
+            *it = channel;
+        }
+        else
+        {
+            channels.emplace_back(channel);
+        }
+        publishChannels(std::move(channels));
+    }
+    updateLevel();
 }
 
 void Logger::del(const std::string &name)
 {
-    _channels.erase(name);
+    {
+        std::lock_guard<std::mutex> lck(_channel_mtx);
+        auto channels = *_channels;
+        auto it = std::find_if(channels.begin(), channels.end(), [&](const std::shared_ptr<LogChannel> &chn)
+                               { return chn->name() == name; });
+        if (it == channels.end())
+        {
+            return;
+        }
+        if ((*it)->_logger == this)
+        {
+            (*it)->_logger = nullptr;
+        }
+        channels.erase(it);
+        publishChannels(std::move(channels));
+    }
+    updateLevel();
+}
+
+void Logger::publishChannels(ChannelList channels)
+{
+    _channels = std::make_shared<const ChannelList>(std::move(channels));
+    _channels_version.fetch_add(1, std::memory_order_release);
+}
+
+const Logger::ChannelList &Logger::channels_l()
+{
+    if (_channels_version.load(std::memory_order_acquire) != _snapshot_version)
+    {
+        // 旧快照在此释放，被删除的通道在最后一个使用者放下引用后析构
+        std::lock_guard<std::mutex> lck(_channel_mtx);
+        _channels_snapshot = _channels;
+        _snapshot_version = _channels_version.load(std::memory_order_relaxed);
+    }
+    return *_channels_snapshot;
 }
 
 void Logger::set_writer(const std::shared_ptr<LogWriter> &writer)
@@ -508,20 +2292,86 @@ void Logger::set_writer(const std::shared_ptr<LogWriter> &writer)
 
 std::shared_ptr<LogChannel> Logger::get(const std::string &name)
 {
-    auto it = _channels.find(name);
-    if (it == _channels.end())
+    std::lock_guard<std::mutex> lck(_channel_mtx);
+    for (auto &chn : *_channels)
     {
-        return nullptr;
+        if (chn->name() == name)
+        {
+            return chn;
+        }
     }
-    return it->second;
+    return nullptr;
 }
 void Logger::setLevel(const LogLevel level)
 {
-    for (auto &chn : _channels)
+    std::shared_ptr<const ChannelList> channels;
+    {
+        std::lock_guard<std::mutex> lck(_channel_mtx);
+        channels = _channels;
+    }
+    // 通道的setLevel会回调updateLevel，不能持有锁
+    for (auto &chn : *channels)
+    {
+        chn->setLevel(level);
+    }
+}
+void Logger::updateLevel()
+{
+    int level = LError + 1;
+    std::lock_guard<std::mutex> lck(_channel_mtx);
+    for (auto &chn : *_channels)
+    {
+        level = std::min<int>(level, chn->getLevel());
+    }
+    _channel_level.store(level, std::memory_order_relaxed);
+    if (_recorder && _recorder->valid())
     {
-        chn.second->setLevel(level);
+        level = std::min<int>(level, _recorder->getLevel());
     }
+    _min_level.store(level, std::memory_order_relaxed);
+}
+
+void Logger::setTimePrecision(int precision)
+{
+    _time_precision = std::max(0, std::min(precision, 6));
+}
+
+int Logger::getTimePrecision() const
+{
+    return _time_precision;
+}
+
+void Logger::setDeferredFormat(bool enable)
+{
+    _deferred_format = enable;
+}
+
+void Logger::setFlightRecorder(const std::shared_ptr<LogFlightRecorder> &recorder)
+{
+    _recorder = recorder;
+    updateLevel();
 }
+
+const std::shared_ptr<LogFlightRecorder> &Logger::getFlightRecorder() const
+{
+    return _recorder;
+}
+
+bool Logger::deferredFormat() const
+{
+    return _deferred_format;
+}
+
+void Logger::setMaxRecordSize(size_t bytes)
+{
+    _max_record_size = bytes;
+}
+
+size_t Logger::maxRecordSize() const
+{
+    return _max_record_size;
+}
+
 const std::string &Logger::getName() const
 {
     return _logger_name;
@@ -529,47 +2379,212 @@ const std::string &Logger::getName() const
 
 void Logger::writeChannels_l(const LogContextPtr &ctx)
 {
-    for (auto &chn : _channels)
+    for (auto &chn : channels_l())
     {
-        chn.second->write(*this, ctx);
+        chn->write(*this, ctx);
     }
-    _last_log = ctx;
-    _last_log->_repeat = 0;
+}
+
+// 带重复次数的副本，已写出的日志可能仍被通道线程引用，不能再修改
+static LogContextPtr cloneRepeated(const LogContextPtr &ctx, int repeat)
+{
+    auto ret = LogContext::create();
+    ret->_level = ctx->_level;
+    ret->_site = ctx->_site;
+    ret->_thread_name = ctx->_thread_name;
+    ret->_thread_id = ctx->_thread_id;
+    ret->_tv = ctx->_tv;
+    auto body = ctx->str();
+    ret->buffer().append(body.data(), body.size());
+    ret->_repeat = repeat;
+    return ret;
 }
 
 // 返回毫秒
-static int64_t timevalDiff(struct timeval &a, struct timeval &b)
+static int64_t timevalDiff(const struct timeval &a, const struct timeval &b)
 {
     return (1000 * (b.tv_sec - a.tv_sec)) + ((b.tv_usec - a.tv_usec) / 1000);
 }
 
+// 当前线程是否正在写通道；通道内部打印的日志不能再进入日志器，同步模式下会重复加锁，异步模式下会等待自己消费队列
+static thread_local bool t_writing_channels = false;
+
+class ChannelWriteGuard
+{
+public:
+    ChannelWriteGuard() : _previous(t_writing_channels) { t_writing_channels = true; }
+    ~ChannelWriteGuard() { t_writing_channels = _previous; }
+
+private:
+    bool _previous;
+};
+
 void Logger::write_channels(const LogContextPtr &ctx)
 {
-    if (ctx->_line == _last_log->_line && ctx->_file == _last_log->_file && ctx->str() == _last_log->str())
+    ChannelWriteGuard guard;
+    if (_repeat_window_ms <= 0)
     {
-        // 重复的日志每隔500ms打印一次，过滤频繁的重复日志
-        ++_last_log->_repeat;
-        if (timevalDiff(_last_log->_tv, ctx->_tv) > 500)
+        writeChannels_l(ctx);
+        return;
+    }
+    // 先输出已超出窗口的重复次数，保持与后续日志的先后顺序
+    flushRepeats(ctx->_tv, false);
+    auto body = ctx->str();
+    auto site = ctx->_site->id ^ (uint64_t)ctx->_level;
+    auto content = fnv1a(body.data(), body.size(), site);
+    auto &entry = _repeat_table[content % s_repeat_table_size];
+    if (entry.ctx && entry.site == site && entry.content == content && entry.ctx->str() == body)
+    {
+        // 重复的日志在窗口内只计数，超出窗口后附带重复次数打印
+        if (!entry.repeat++)
+        {
+            if (!_repeat_pending++ || timercmp(&entry.tv, &_repeat_earliest, <))
+            {
+                _repeat_earliest = entry.tv;
+            }
+        }
+        if (timevalDiff(entry.tv, ctx->_tv) > _repeat_window_ms)
         {
-            ctx->_repeat = _last_log->_repeat;
+            ctx->_repeat = entry.repeat;
+            entry.ctx = ctx;
+            entry.tv = ctx->_tv;
+            entry.repeat = 0;
+            --_repeat_pending;
             writeChannels_l(ctx);
         }
         return;
     }
-    if (_last_log->_repeat)
+    if (entry.ctx && entry.repeat)
     {
-        writeChannels_l(_last_log);
+        // 被替换的条目还有未输出的重复次数
+        --_repeat_pending;
+        writeChannels_l(cloneRepeated(entry.ctx, entry.repeat));
     }
+    entry.site = site;
+    entry.content = content;
+    entry.ctx = ctx;
+    entry.tv = ctx->_tv;
+    entry.repeat = 0;
     writeChannels_l(ctx);
 }
+
+void Logger::flushRepeats(const struct timeval &now, bool force)
+{
+    if (!_repeat_pending || (!force && timevalDiff(_repeat_earliest, now) <= _repeat_window_ms))
+    {
+        return;
+    }
+    struct timeval earliest = now;
+    for (auto &entry : _repeat_table)
+    {
+        if (!entry.repeat)
+        {
+            continue;
+        }
+        if (force || timevalDiff(entry.tv, now) > _repeat_window_ms)
+        {
+            // 重新计时，之后的重复日志按新的窗口合并
+            writeChannels_l(cloneRepeated(entry.ctx, entry.repeat));
+            entry.tv = now;
+            entry.repeat = 0;
+            --_repeat_pending;
+        }
+        else if (timercmp(&entry.tv, &earliest, <))
+        {
+            earliest = entry.tv;
+        }
+    }
+    _repeat_earliest = earliest;
+}
+
+void Logger::setRepeatWindow(size_t ms)
+{
+    _repeat_window_ms = (int64_t)ms;
+}
+
 void Logger::write(const LogContextPtr &logContext)
 {
+    if (_recorder)
+    {
+        _recorder->record(*logContext);
+    }
+    if (logContext->_level < _channel_level.load(std::memory_order_relaxed))
+    {
+        return;
+    }
+    if (t_writing_channels)
+    {
+        // 通道写入过程中产生的日志(如打开文件失败)直接输出到标准错误
+        fprintf(stderr, "%s:%d %s\n", logContext->_site->file, logContext->_site->line, logContext->str().data());
+        return;
+    }
     if (_writer)
     {
         _writer->write(logContext, *this);
     }
     else
     {
+        // 同步模式下各线程串行写通道；没有写线程空闲的时机，每条日志后立即写出
+        std::lock_guard<std::mutex> lck(_sync_mtx);
         write_channels(logContext);
+        flushChannels();
+        if (_repeat_pending)
+        {
+            // 之后可能不再有日志，由定时线程在窗口到期时输出重复次数
+            if (!_repeat_timer.joinable())
+            {
+                _repeat_timer = std::thread(&Logger::runRepeatTimer, this);
+            }
+            _repeat_cond.notify_one();
+        }
+    }
+}
+
+int64_t Logger::repeatFlushDelay() const
+{
+    if (!_repeat_pending)
+    {
+        return -1;
+    }
+    struct timeval now;
+    gettimeofday(&now, nullptr);
+    // flushRepeats在超出窗口(大于window)时才输出，多等1毫秒
+    return std::max<int64_t>(0, _repeat_window_ms + 1 - timevalDiff(_repeat_earliest, now));
+}
+
+void Logger::runRepeatTimer()
+{
+    setThreadName("log repeat");
+    std::unique_lock<std::mutex> lck(_sync_mtx);
+    while (!_repeat_timer_exit)
+    {
+        auto delay = repeatFlushDelay();
+        if (delay < 0)
+        {
+            _repeat_cond.wait(lck);
+        }
+        else if (delay > 0)
+        {
+            _repeat_cond.wait_for(lck, std::chrono::milliseconds(delay));
+        }
+        else
+        {
+            flushChannels();
+        }
+    }
+}
+
+void Logger::flushChannels()
+{
+    ChannelWriteGuard guard;
+    if (_repeat_pending)
+    {
+        struct timeval now;
+        gettimeofday(&now, nullptr);
+        flushRepeats(now, false);
+    }
+    for (auto &chn : channels_l())
+    {
+        chn->flush();
     }
 }
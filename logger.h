@@ -1,3 +1,6 @@
+#ifndef LOGGER_H
+#define LOGGER_H
+
 #include <memory>
 #include <thread>
 #include <iostream>
@@ -6,13 +9,54 @@
 #include <map>
 #include <list>
 #include <set>
+#include <atomic>
+#include <string_view>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+#if !defined(_WIN32)
+#include <sys/uio.h>
+#else
+struct iovec
+{
+    void *iov_base;
+    size_t iov_len;
+};
+#endif
 #include "tools.h"
+#include "mpscQueue.h"
 
 class LogContext;
 class Logger;
 class LogChannel;
+class LogFlightRecorder;
+
+/**
+ * 日志上下文的侵入式引用计数指针
+ * 引用计数归零时LogContext回收至对象池而不是释放
+ */
+class LogContextPtr
+{
+public:
+    LogContextPtr() = default;
+    LogContextPtr(std::nullptr_t) {}
+    explicit LogContextPtr(LogContext *ctx);
+    LogContextPtr(const LogContextPtr &that);
+    LogContextPtr(LogContextPtr &&that) noexcept;
+    ~LogContextPtr();
+
+    LogContextPtr &operator=(const LogContextPtr &that);
+    LogContextPtr &operator=(LogContextPtr &&that) noexcept;
+
+    void reset();
+    LogContext *get() const { return _ptr; }
+    LogContext *operator->() const { return _ptr; }
+    LogContext &operator*() const { return *_ptr; }
+    explicit operator bool() const { return _ptr != nullptr; }
 
-using LogContextPtr = std::shared_ptr<LogContext>;
+private:
+    LogContext *_ptr = nullptr;
+};
 
 typedef enum
 {
@@ -23,6 +67,137 @@ typedef enum
     LError
 } LogLevel;
 
+/**
+ * 日志调用位置的静态描述，由日志宏在每个展开处于编译期生成，日志只保存指向它的指针
+ * 日志等级不在其中，日志宏的等级可以是运行时的值
+ */
+struct LogCallSite
+{
+    int line;
+    // 不含路径的文件名
+    const char *file;
+    const char *function;
+    const char *flag;
+    // 由完整路径与行号计算的调用位置标识，用于去重、采样等
+    uint64_t id;
+    // 按文件或flag配置的日志等级缓存，高24位为配置版本号，见Logger::setModuleLevels
+    mutable std::atomic<uint32_t> module_level;
+};
+
+// 按文件或flag配置日志等级的版本号，0表示没有任何配置
+extern std::atomic<uint32_t> g_moduleLevelGeneration;
+// 调用位置没有匹配的等级配置
+#define LOG_LEVEL_UNSET 0xff
+
+// 重新匹配调用位置的等级配置并写入缓存
+int resolveModuleLevel(const LogCallSite &site);
+
+/**
+ * 调用位置按文件或flag配置的日志等级，没有匹配时返回LOG_LEVEL_UNSET
+ * 配置变化后每个调用位置只重新匹配一次，之后只需一次比较
+ */
+inline int moduleLevel(const LogCallSite &site)
+{
+    auto generation = g_moduleLevelGeneration.load(std::memory_order_relaxed);
+    if (!generation)
+    {
+        return LOG_LEVEL_UNSET;
+    }
+    auto cached = site.module_level.load(std::memory_order_relaxed);
+    if ((cached >> 8) == generation)
+    {
+        return cached & 0xff;
+    }
+    return resolveModuleLevel(site);
+}
+
+// 进程内存在的ScopedLogLevel个数，为0时不必读取线程局部变量
+extern std::atomic<int> g_threadLevelOverrides;
+// 当前线程的日志等级覆盖，见ScopedLogLevel
+extern thread_local int t_threadLevelOverride;
+
+/**
+ * 调用位置的等级覆盖，当前线程的覆盖优先于按文件或flag的配置，没有覆盖时返回LOG_LEVEL_UNSET
+ */
+inline int overrideLevel(const LogCallSite &site)
+{
+    if (g_threadLevelOverrides.load(std::memory_order_relaxed) && t_threadLevelOverride != LOG_LEVEL_UNSET)
+    {
+        return t_threadLevelOverride;
+    }
+    return moduleLevel(site);
+}
+
+/**
+ * 在作用域内覆盖当前线程的日志等级，可嵌套，例如只对某个问题请求打开Trace日志
+ * 覆盖的等级可保存在请求上下文中，在处理该请求的线程上重新生效:
+ *     req.log_level = ScopedLogLevel::current();
+ *     ...
+ *     ScopedLogLevel guard(req.log_level);
+ * 覆盖等级只决定调用位置是否产生日志，各通道仍按自身等级过滤
+ * 作用域结束时恢复外层的等级，内层传入LOG_LEVEL_UNSET可在作用域内清除外层的覆盖
+ */
+class ScopedLogLevel : public noncopyable
+{
+public:
+    /**
+     * @param level 日志等级，LOG_LEVEL_UNSET表示作用域内没有覆盖
+     */
+    explicit ScopedLogLevel(int level);
+    ~ScopedLogLevel();
+
+    /**
+     * 当前线程生效的覆盖等级，没有覆盖时返回LOG_LEVEL_UNSET
+     */
+    static int current();
+
+private:
+    int _previous;
+};
+
+// 编译期取路径中的文件名
+constexpr const char *logBaseName(const char *path)
+{
+    const char *name = path;
+    for (auto p = path; *p; ++p)
+    {
+#ifdef _WIN32
+        if (*p == '/' || *p == '\\')
+#else
+        if (*p == '/')
+#endif
+        {
+            name = p + 1;
+        }
+    }
+    return name;
+}
+
+// 编译期去掉函数名中的类名前缀，仅windows下__FUNCTION__包含类名
+constexpr const char *logFunctionName(const char *func)
+{
+#ifdef _WIN32
+    const char *name = func;
+    for (auto p = func; *p; ++p)
+    {
+        if (*p == ':')
+        {
+            name = p + 1;
+        }
+    }
+    return name;
+#else
+    return func;
+#endif
+}
+
+#define LOG_CALL_SITE(flag)                                                                   \
+    LogCallSite                                                                               \
+    {                                                                                         \
+        __LINE__, logBaseName(__FILE__), logFunctionName(__FUNCTION__), flag,                 \
+            fnv1a(__FILE__, sizeof(__FILE__) - 1, (uint64_t)__LINE__), {0}                    \
+    }
+
 Logger &getLogger();
 void setLogger(Logger *logger);
 
@@ -38,61 +213,412 @@ public:
 
     virtual void write(const LogContextPtr &ctx, Logger &logger) = 0;
 };
+/**
+ * 异步队列满时的处理策略
+ */
+enum LogOverflowPolicy
+{
+    // 生产者等待写线程消费
+    LogOverflowBlock = 0,
+    // 丢弃新产生的日志
+    LogOverflowDropNewest,
+    // 生产者丢弃队列中最早的日志腾出空间，写线程阻塞在写文件时也不等待
+    LogOverflowDropOldest,
+    // 丢弃低于指定等级的新日志，达到该等级的日志等待写入
+    LogOverflowDropBelowLevel
+};
+
 class LogAsyncWriter : public LogWriter
 {
 public:
-    LogAsyncWriter();
+    /**
+     * @param capacity 异步队列容量(日志条数)
+     * @param max_bytes 队列中日志内容的总字节数上限，0表示不限制
+     */
+    LogAsyncWriter(size_t capacity = 16 * 1024, size_t max_bytes = 64 * 1024 * 1024);
     ~LogAsyncWriter();
 
+    /**
+     * 设置队列满时的处理策略，默认LogOverflowBlock
+     * @param keep_level LogOverflowDropBelowLevel策略下保留的最低等级
+     */
+    void setOverflowPolicy(LogOverflowPolicy policy, LogLevel keep_level = LWarn);
+
+    /**
+     * 累计丢弃的日志条数
+     */
+    uint64_t dropped() const;
+
+    /**
+     * 队列中等待写入的日志条数与内容字节数
+     */
+    size_t queued() const;
+    size_t queuedBytes() const;
+
 private:
+    struct Item
+    {
+        LogContextPtr ctx;
+        Logger *logger = nullptr;
+        size_t bytes = 0;
+    };
+
     void write(const LogContextPtr &ctx, Logger &logger) override;
     void flushAll();
     void run();
+    void drop(const LogContextPtr &ctx, Logger &logger);
+    // 生产者丢弃队列中最早的一条日志，队列为空或最早的日志尚未写完时返回false
+    bool dropOldest();
+    // 队列是否有空间放入bytes字节的日志
+    bool hasRoom(size_t bytes) const;
+    // 生产者等待写线程腾出空间
+    void waitForRoom(size_t bytes);
+    // 写线程取出一批日志后唤醒等待空间的生产者
+    void notifyRoom();
+    // 压力解除后输出丢弃统计
+    void reportDropped();
+    // 距最近一个日志器的重复次数到期的毫秒数，没有待输出的重复次数时返回-1
+    int64_t repeatFlushDelay();
 
 private:
     std::shared_ptr<std::thread> m_thread;
     semphore m_sem;
     Logger &m_pLogInstance;
-    std::list<std::pair<LogContextPtr, Logger *>> _pending;
-    std::mutex m_mutex;
-    bool m_bExit;
+    MPSCQueue<Item> _pending;
+    size_t _max_bytes;
+    std::atomic<size_t> _pending_bytes{0};
+    std::atomic<int> _policy{LogOverflowBlock};
+    std::atomic<int> _keep_level{LWarn};
+    // 队列满时等待空间的生产者
+    std::mutex _room_mtx;
+    std::condition_variable _room_cond;
+    std::atomic<int> _room_waiters{0};
+    // 各等级丢弃条数，输出统计后清零
+    std::atomic<uint64_t> _dropped[LError + 1];
+    std::atomic<uint64_t> _dropped_total{0};
+    // 最近丢弃日志所属的日志器，统计输出到该日志器
+    std::atomic<Logger *> _drop_logger{nullptr};
+    // 本轮写过日志的日志器
+    std::vector<Logger *> _flush_loggers;
+    // 有待输出重复次数的日志器，写线程空闲时按到期时间定时唤醒输出
+    std::vector<Logger *> _repeat_loggers;
+    // 写线程是否即将休眠，生产者据此决定是否需要唤醒
+    std::atomic<bool> m_bSleeping;
+    std::atomic<bool> m_bExit;
+};
+
+/**
+ * 日志内容缓冲区，复用时保留已分配的容量
+ */
+class LogStreamBuf : public std::streambuf
+{
+public:
+    LogStreamBuf() = default;
+    ~LogStreamBuf() override;
+
+    // 清空内容，保留容量
+    void reset();
+    // 释放超过指定大小的缓冲区，防止偶发的超长日志长期占用内存
+    void shrink(size_t max_capacity);
+    // 以'\0'结尾的日志内容
+    const char *data();
+    size_t size() const;
+    // 追加原始字节
+    void append(const void *data, size_t size);
+    // 确保至少有n字节可写空间，返回写入位置，写完后调用commit提交实际写入的字节数
+    char *prepare(size_t n);
+    void commit(size_t n);
+
+    // 设置内容长度上限，超出部分丢弃，0表示不限制；reset后恢复为不限制
+    void setLimit(size_t limit);
+    size_t limit() const { return _limit; }
+    // 因超出上限被丢弃的字节数
+    size_t truncated() const { return _truncated; }
+    // 记录在外部被丢弃的字节数
+    void discard(size_t n) { _truncated += n; }
+
+protected:
+    int_type overflow(int_type ch) override;
+    std::streamsize xsputn(const char *s, std::streamsize n) override;
+
+private:
+    void grow(size_t need);
+    // 按上限截断即将写入的字节数
+    size_t clamp(size_t n);
+
+private:
+    char *_buf = nullptr;
+    size_t _capacity = 0;
+    size_t _limit = 0;
+    size_t _truncated = 0;
+};
+
+/**
+ * 延迟格式化模式下参数的类型标记，参数以[类型][原始字节]的形式保存
+ */
+enum LogArgType : uint8_t
+{
+    LogArgBool = 0,
+    LogArgChar,
+    LogArgSChar,
+    LogArgUChar,
+    LogArgShort,
+    LogArgUShort,
+    LogArgInt,
+    LogArgUInt,
+    LogArgLong,
+    LogArgULong,
+    LogArgLongLong,
+    LogArgULongLong,
+    LogArgFloat,
+    LogArgDouble,
+    LogArgLongDouble,
+    LogArgPointer,
+    // 字符串：[uint32长度][内容]
+    LogArgString,
+    // std::hex等格式控制函数
+    LogArgManip,
+    LogArgNone
+};
+
+template <typename T>
+struct LogArgTypeOf : std::integral_constant<LogArgType, LogArgNone>
+{
+};
+#define LOG_ARG_TYPE(type, tag) \
+    template <>             \
+    struct LogArgTypeOf<type> : std::integral_constant<LogArgType, tag> {};
+LOG_ARG_TYPE(bool, LogArgBool)
+LOG_ARG_TYPE(char, LogArgChar)
+LOG_ARG_TYPE(signed char, LogArgSChar)
+LOG_ARG_TYPE(unsigned char, LogArgUChar)
+LOG_ARG_TYPE(short, LogArgShort)
+LOG_ARG_TYPE(unsigned short, LogArgUShort)
+LOG_ARG_TYPE(int, LogArgInt)
+LOG_ARG_TYPE(unsigned int, LogArgUInt)
+LOG_ARG_TYPE(long, LogArgLong)
+LOG_ARG_TYPE(unsigned long, LogArgULong)
+LOG_ARG_TYPE(long long, LogArgLongLong)
+LOG_ARG_TYPE(unsigned long long, LogArgULongLong)
+LOG_ARG_TYPE(float, LogArgFloat)
+LOG_ARG_TYPE(double, LogArgDouble)
+LOG_ARG_TYPE(long double, LogArgLongDouble)
+#undef LOG_ARG_TYPE
+
+/**
+ * 按默认格式渲染好的一条日志，由头部、正文、尾部三段组成
+ * 头部与尾部由LogContext缓存，正文即LogContext::str()
+ */
+struct LogRendered
+{
+    std::string_view head;
+    std::string_view body;
+    std::string_view tail;
+
+    bool empty() const { return head.empty() && body.empty() && tail.empty(); }
+    size_t size() const { return head.size() + body.size() + tail.size(); }
 };
 
-class LogContext : public std::ostringstream
+class LogContext : public std::ostream
 {
 public:
-    LogContext() = default;
-    LogContext(LogLevel level, const char *file, const char *function, int line, const char *module_name, const char *flag);
-    ~LogContext() = default;
+    friend class LogContextPtr;
+    friend class LogContextPool;
+    friend class LogChannel;
+    friend class LogFlightRecorder;
+
+    /**
+     * 从对象池获取日志上下文
+     */
+    static LogContextPtr create();
+    static LogContextPtr create(const LogCallSite &site, LogLevel level);
+
+    /**
+     * 进程内LogContext及其缓冲区累计的堆内存分配次数，稳态下应不再增长
+     */
+    static uint64_t allocCount();
+
+    std::string_view str();
+
+    // 日志内容缓冲区，供格式化接口直接写入
+    LogStreamBuf &buffer() { return _sbuf; }
+
+    // 日志内容占用的字节数，用于限制异步队列的内存
+    size_t bytes() const { return _sbuf.size() + _args.size(); }
+
+    /**
+     * 将延迟格式化保存的参数渲染到ost，数据可以在任意参数处截断，截断的参数不输出
+     * @param manipulators 是否执行流操纵符，参数来自其他进程时函数指针无效，必须为false
+     */
+    static void renderArgs(std::ostream &ost, const char *data, size_t size, bool manipulators);
 
-    const std::string &str();
+    /**
+     * 延迟格式化模式下保存参数，数值与字符串仅拷贝原始字节，在str()中才转换为文本
+     * 不支持的类型会先渲染之前保存的参数，再立即格式化，保证输出顺序与流状态不变
+     */
+    template <typename T>
+    void defer(T &&data)
+    {
+        using U = typename std::decay<T>::type;
+        using Pointee = typename std::remove_cv<typename std::remove_pointer<U>::type>::type;
+        if constexpr (LogArgTypeOf<U>::value != LogArgNone)
+        {
+            deferArg(LogArgTypeOf<U>::value, &data, sizeof(U));
+        }
+        else if constexpr (std::is_same<U, std::ios_base &(*)(std::ios_base &)>::value)
+        {
+            U func = data;
+            deferArg(LogArgManip, &func, sizeof(func));
+        }
+        else if constexpr (std::is_same<U, std::string>::value || std::is_same<U, std::string_view>::value)
+        {
+            deferString(data.data(), data.size());
+        }
+        else if constexpr (std::is_same<U, const char *>::value || std::is_same<U, char *>::value)
+        {
+            const char *str = data;
+            if (str)
+            {
+                deferString(str, strlen(str));
+            }
+            else
+            {
+                renderArgs();
+                (*this) << std::forward<T>(data);
+            }
+        }
+        else if constexpr (std::is_pointer<U>::value && std::is_object<Pointee>::value &&
+                           !std::is_same<Pointee, char>::value && !std::is_same<Pointee, signed char>::value &&
+                           !std::is_same<Pointee, unsigned char>::value)
+        {
+            const void *ptr = data;
+            deferArg(LogArgPointer, &ptr, sizeof(ptr));
+        }
+        else
+        {
+            renderArgs();
+            (*this) << std::forward<T>(data);
+        }
+    }
 
     LogLevel _level;
-    int _line;
+    // 指向静态的调用位置描述，不会为空
+    const LogCallSite *_site;
     int _repeat = 0;
-    std::string _file;
-    std::string _function;
-    std::string _thread_name;
-    std::string _module_name;
-    std::string _flag;
+    // 限频宏在本条日志之前抑制的次数
+    uint64_t _suppressed = 0;
+    // 线程名指向进程内驻留的字符串，无需拷贝
+    const char *_thread_name;
+    uint64_t _thread_id;
     struct timeval _tv;
 
+    // 是否使用延迟格式化
+    bool _deferred = false;
+
+private:
+    LogContext();
+    ~LogContext() = default;
+    void reset();
+    // 引用计数归零，归还对象池
+    static void recycle(LogContext *ctx);
+    void deferArg(LogArgType type, const void *data, size_t size);
+    void deferString(const char *data, size_t size);
+    // 将已保存的参数渲染为文本
+    void renderArgs();
+
 private:
-    bool _got_content = false;
-    std::string _content;
+    std::atomic<uint32_t> _ref{0};
+    // 对象池空闲链表
+    LogContext *_next = nullptr;
+    LogStreamBuf _sbuf;
+    // 延迟格式化的参数
+    LogStreamBuf _args;
+    // 超出长度上限被整个丢弃的参数个数，与截断的文本字节数分开统计
+    uint32_t _dropped_args = 0;
+
+    // 默认格式的渲染缓存，按是否彩色、是否显示详情分为4种
+    // 每种各用一个缓冲区，渲染新的格式不会使其他通道已取得的结果失效
+    struct RenderSlot
+    {
+        std::atomic<bool> valid{false};
+        uint32_t head_end;
+        LogStreamBuf buf;
+    };
+    RenderSlot _render_slots[4];
+    // 多个通道线程可能同时渲染同一条日志
+    std::mutex _render_mtx;
 };
 
+inline LogContextPtr::LogContextPtr(LogContext *ctx) : _ptr(ctx)
+{
+    if (_ptr)
+    {
+        _ptr->_ref.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+inline LogContextPtr::LogContextPtr(const LogContextPtr &that) : LogContextPtr(that._ptr) {}
+
+inline LogContextPtr::LogContextPtr(LogContextPtr &&that) noexcept : _ptr(that._ptr)
+{
+    that._ptr = nullptr;
+}
+
+inline LogContextPtr::~LogContextPtr()
+{
+    reset();
+}
+
+inline LogContextPtr &LogContextPtr::operator=(const LogContextPtr &that)
+{
+    if (_ptr != that._ptr)
+    {
+        LogContextPtr tmp(that);
+        std::swap(_ptr, tmp._ptr);
+    }
+    return *this;
+}
+
+inline LogContextPtr &LogContextPtr::operator=(LogContextPtr &&that) noexcept
+{
+    if (this != &that)
+    {
+        reset();
+        _ptr = that._ptr;
+        that._ptr = nullptr;
+    }
+    return *this;
+}
+
+inline void LogContextPtr::reset()
+{
+    if (_ptr && _ptr->_ref.fetch_sub(1, std::memory_order_acq_rel) == 1)
+    {
+        LogContext::recycle(_ptr);
+    }
+    _ptr = nullptr;
+}
+
 class LogCapturer
 {
 public:
     using Ptr = std::shared_ptr<LogCapturer>;
 
+    LogCapturer(Logger &logger, const LogCallSite &site, LogLevel level);
+    /**
+     * 兼容旧接口，调用位置在首次使用时登记并常驻内存，每次调用需查表，日志宏不使用
+     */
     LogCapturer(Logger &logger, LogLevel level, const char *file, const char *function, int line, const char *flag = "");
     LogCapturer(const LogCapturer &that);
     ~LogCapturer();
 
     LogCapturer &operator<<(std::ostream &(*func)(std::ostream &));
 
+    /**
+     * 记录该调用位置在本条日志之前被限频宏抑制的次数
+     */
+    LogCapturer &suppressed(uint64_t count);
+
     template <typename T>
     LogCapturer &operator<<(T &&data)
     {
@@ -100,15 +626,50 @@ public:
         {
             return *this;
         }
-        (*_ctx) << std::forward<T>(data);
+        if (_ctx->_deferred)
+        {
+            _ctx->defer(std::forward<T>(data));
+        }
+        else
+        {
+            (*_ctx) << std::forward<T>(data);
+        }
         return *this;
     }
 
+private:
+    template <typename S, typename... Args>
+    friend void logFormat(LogCapturer &&capturer, S fmt, const Args &...args);
+
 private:
     LogContextPtr _ctx;
     Logger &_logger;
 };
 
+/**
+ * 调用位置的限频与采样状态，由限频宏定义为静态变量
+ * 在构造LogContext之前判断是否输出，被抑制的调用只有一次原子操作
+ */
+class LogSiteLimiter
+{
+public:
+    // 每n次输出一次
+    bool everyN(uint64_t n);
+    // 每ms毫秒最多输出一次
+    bool everyMs(uint64_t ms);
+    // 只输出前n次
+    bool firstN(uint64_t n);
+    // 按概率rate输出
+    bool sample(double rate);
+    // 取出上次输出以来被抑制的次数并清零
+    uint64_t takeSuppressed();
+
+private:
+    std::atomic<uint64_t> _count{0};
+    std::atomic<uint64_t> _suppressed{0};
+    std::atomic<uint64_t> _next_ms{0};
+};
+
 class LogChannel : public noncopyable
 {
 public:
@@ -116,17 +677,49 @@ public:
     virtual ~LogChannel();
     const std::string &name() const;
     void setLevel(LogLevel level);
+    LogLevel getLevel() const;
     static std::string printTime(const timeval &tv);
+    /**
+     * 格式化日志时间至调用者提供的缓冲区
+     * 年月日时分秒部分每线程每秒只格式化一次，其余时间只填写秒的小数部分
+     * @param precision 秒的小数位数，0~6，3为毫秒，6为微秒
+     * @return 写入的字节数，不含结尾的'\0'
+     */
+    static size_t printTime(const timeval &tv, char *buf, size_t size, int precision = 3);
     virtual void write(const Logger &logger, const LogContextPtr &ctx) = 0;
+    // 写出缓冲的日志，写线程空闲时调用
+    virtual void flush() {}
 
 protected:
+    /**
+     * 格式化日志至ost，默认输出render()的结果
+     * 需要自定义格式的通道可重载此函数，不再共享渲染结果
+     */
     virtual void format(const Logger &logger, std::ostream &ost, const LogContextPtr &ctx, bool enable_color = true, bool enable_detail = true);
 
+    /**
+     * 按默认格式渲染日志，同一条日志在所有通道间只渲染一次
+     * 返回的头部与尾部在下次对该日志调用render前有效
+     */
+    static LogRendered render(const Logger &logger, const LogContextPtr &ctx, bool enable_color = true, bool enable_detail = true);
+
+private:
+    static void renderSlot(const Logger &logger, const LogContextPtr &ctx, LogContext::RenderSlot &slot, bool enable_color, bool enable_detail);
+
 protected:
+    friend class Logger;
     std::string _name;
-    LogLevel _level;
+    // 可在写线程输出日志时修改
+    std::atomic<LogLevel> _level;
+    // 所属的日志器，通道等级变化时通知其更新最低日志等级
+    Logger *_logger = nullptr;
 };
 
+/**
+ * 文件日志通道
+ * 日志先缓存在用户态，缓冲满、写线程空闲或超过最长延迟时通过writev批量写入
+ * 头部与尾部拷贝至缓冲区，正文直接引用LogContext，以分散/聚集的方式写出
+ */
 class FileChannelBase : public LogChannel
 {
 public:
@@ -134,24 +727,74 @@ public:
     ~FileChannelBase() override;
 
     void write(const Logger &logger, const LogContextPtr &logContext) override;
+    void flush() override;
     bool setPath(const std::string &path);
     const std::string &path() const;
 
+    /**
+     * 设置写缓冲大小，缓冲中的日志达到该大小时写入文件
+     * @param size 字节，0表示每条日志立即写入
+     */
+    void setBufferSize(size_t size);
+
+    /**
+     * 设置日志在缓冲中的最长停留时间
+     * @param ms 毫秒
+     */
+    void setMaxLatency(size_t ms);
+
 protected:
     virtual bool open();
     virtual void close();
     virtual size_t size();
 
+    /**
+     * 写入一组数据，子类可重载以更换写入方式
+     * @param iov 数据块，调用期间可被修改
+     * @param count 数据块个数
+     * @param bytes 总字节数
+     * @return 是否全部写入成功
+     */
+    virtual bool writeOut(struct iovec *iov, int count, size_t bytes);
+
+    /**
+     * 关闭文件描述符，子类可重载以异步关闭
+     */
+    virtual void closeFd(int fd);
+
+private:
+    void append(const char *data, size_t size, bool copy);
+
 protected:
     std::string _path;
-    std::ofstream _fstream;
+    int _fd = -1;
+    // 当前文件大小，包括缓冲中尚未写出的部分
+    size_t _file_size = 0;
+    // 以读写方式打开文件，内存映射需要
+    bool _open_rdwr = false;
+    // 预先打开好的文件，下次open时直接使用
+    int _adopt_fd = -1;
+
+private:
+    size_t _buffer_size = 256 * 1024;
+    size_t _max_latency_ms = 100;
+    // 第一条缓冲日志的时间
+    uint64_t _first_pending_ms = 0;
+    size_t _pending_bytes = 0;
+    // 头部与尾部的拷贝区
+    std::unique_ptr<char[]> _arena;
+    size_t _arena_size = 0;
+    size_t _arena_used = 0;
+    std::vector<struct iovec> _iov;
+    // 正文被引用的日志，写出后释放
+    std::vector<LogContextPtr> _holding;
 };
 
 class LogFileChannel : public FileChannelBase
 {
 public:
     LogFileChannel(const std::string &name = "FileChannel", const std::string &dir = exeDir() + "logs/", LogLevel level = LTrace);
-    ~LogFileChannel() override = default;
+    ~LogFileChannel() override;
     void write(const Logger &logger, const LogContextPtr &logContext) override;
     /**
      * 设置日志最大保存天数
@@ -171,10 +814,31 @@ public:
      */
     void setFileMaxCount(size_t max_count);
 
-private:
+    /**
+     * 开启切片压缩，切换下来的切片在后台线程中压缩为.log.gz
+     * 压缩后的切片同样计入保存天数与个数，压缩结果会记录到当前切片中
+     */
+    void setCompress(bool enable);
+
+protected:
+    // 切换到新的切片文件
     void changeFile(time_t second);
-    void checkSize(time_t second);
+    // 切片文件最大字节数
+    size_t maxFileSize() const;
+    // 当前切片是否放不下这条日志，为true时在写入前切片；默认只按已写入的字节数判断
+    virtual bool wouldOverflow(const Logger &logger, const LogContextPtr &ctx);
+
+    void closeFd(int fd) override;
+
+private:
+    void checkSize(time_t second, const Logger &logger, const LogContextPtr &ctx);
     void clean();
+    // 提交待压缩的切片
+    void compressFile(const std::string &path);
+    // 把压缩线程的统计结果写入本通道
+    void writeCompressReport(const Logger &logger);
+    // 在后台线程中预先创建下一个切片
+    void prepareNext();
 
 private:
     bool _can_write = false;
@@ -187,9 +851,111 @@ private:
     // 当前日志切片文件索引
     size_t _index = 0;
     int64_t _last_day = -1;
-    time_t _last_check_time = 0;
+    // 切片期间旧文件在后台线程中关闭
+    bool _rotating = false;
     std::string _dir;
+    // 所有切片，压缩过的切片也按压缩前的.log路径记录
     std::set<std::string> _log_file_map;
+    bool _compress = false;
+    // 是否已提交之前遗留的未压缩切片
+    bool _compress_scanned = false;
+    struct CompressReport;
+    std::shared_ptr<CompressReport> _compress_report;
+    // 预先创建的下一个切片，与后台线程共享
+    struct NextFile;
+    std::shared_ptr<NextFile> _next;
+};
+
+class LogUring;
+
+/**
+ * 通过io_uring异步写文件的日志通道，切片与清理规则同LogFileChannel
+ * 数据拷贝到预注册的缓冲后按显式偏移提交，同时可有多个写请求在途，
+ * 写线程不必等待磁盘完成即可继续消费队列
+ * 内核不支持io_uring时自动退化为writev同步写入
+ */
+class LogUringFileChannel : public LogFileChannel
+{
+public:
+    /**
+     * @param depth 在途写请求(注册缓冲)个数
+     * @param buffer_size 每个注册缓冲的大小
+     */
+    LogUringFileChannel(const std::string &name = "UringFileChannel", const std::string &dir = exeDir() + "logs/", LogLevel level = LTrace,
+                        size_t depth = 8, size_t buffer_size = 256 * 1024);
+    ~LogUringFileChannel() override;
+
+    /**
+     * 是否正在使用io_uring，false表示已退化为同步写入
+     */
+    bool uringEnabled() const;
+
+protected:
+    bool open() override;
+    void close() override;
+    bool writeOut(struct iovec *iov, int count, size_t bytes) override;
+
+private:
+    struct Slot
+    {
+        char *data = nullptr;
+        size_t used = 0;
+        uint64_t offset = 0;
+        bool busy = false;
+    };
+
+    // 提交当前缓冲
+    bool submitSlot();
+    // 取得一个空闲缓冲，必要时等待在途请求完成
+    bool acquireSlot();
+    // 处理完成事件，wait为true时至少等待一个
+    void reap(bool wait);
+    // 等待所有在途请求完成
+    void drain();
+    // io_uring不可用，等待在途请求完成后退化为同步写入
+    void disableRing();
+
+private:
+    std::unique_ptr<LogUring> _ring;
+    std::vector<Slot> _slots;
+    size_t _slot_size;
+    int _cur = -1;
+    size_t _inflight = 0;
+    // 写请求返回不支持、提交失败或在途请求无法收割，下一次写入时退化为同步写入
+    bool _ring_failed = false;
+    // 下一次提交的文件偏移
+    uint64_t _offset = 0;
+};
+
+/**
+ * 预分配并内存映射切片文件的日志通道，切片与清理规则同LogFileChannel
+ * 打开切片时用fallocate预分配setFileMaxSize大小并映射，日志直接拷贝进映射区，不再有write系统调用
+ * 剩余空间放不下下一条日志时立即切片，切片大小不会超过上限；切片或关闭时截断到实际长度
+ * 进程异常退出时切片末尾会残留未截断的零字节
+ */
+class LogMmapFileChannel : public LogFileChannel
+{
+public:
+    LogMmapFileChannel(const std::string &name = "MmapFileChannel", const std::string &dir = exeDir() + "logs/", LogLevel level = LTrace);
+    ~LogMmapFileChannel() override;
+
+protected:
+    bool open() override;
+    void close() override;
+    bool writeOut(struct iovec *iov, int count, size_t bytes) override;
+    // 映射区剩余空间放不下这条日志
+    bool wouldOverflow(const Logger &logger, const LogContextPtr &ctx) override;
+
+private:
+    // 把文件扩展到size并重新映射，失败时文件截断回实际长度
+    bool map(size_t size);
+    void unmap();
+
+private:
+    char *_map = nullptr;
+    size_t _map_size = 0;
+    // 映射区中已写入的长度，即文件实际长度
+    size_t _map_used = 0;
 };
 
 class LogConsoleChannel : public LogChannel
@@ -201,6 +967,63 @@ public:
     void write(const Logger &logger, const LogContextPtr &logContext) override;
 };
 
+/**
+ * 异步通道，被包装的一个或一组通道在独立的线程中写入，慢速通道不会拖慢其他通道
+ * 日志以引用计数共享，入队不拷贝内容；队列满时丢弃并计数，不阻塞日志写线程
+ * 通道等级请通过本通道设置
+ */
+class LogAsyncChannel : public LogChannel
+{
+public:
+    struct Stats
+    {
+        // 已写入被包装通道的日志条数
+        uint64_t written;
+        // 队列满被丢弃的日志条数
+        uint64_t dropped;
+        // 从入队到写入的延迟，微秒
+        uint64_t max_lag_us;
+        uint64_t avg_lag_us;
+        // 当前排队条数
+        size_t queued;
+    };
+
+    /**
+     * @param channels 在同一线程中写入的一组通道
+     * @param capacity 队列容量(日志条数)
+     */
+    LogAsyncChannel(const std::string &name, std::vector<std::shared_ptr<LogChannel>> channels, size_t capacity = 16 * 1024);
+    explicit LogAsyncChannel(const std::shared_ptr<LogChannel> &channel, size_t capacity = 16 * 1024);
+    ~LogAsyncChannel() override;
+
+    void write(const Logger &logger, const LogContextPtr &ctx) override;
+    Stats stats() const;
+
+private:
+    void run();
+    // 写出队列中的日志，返回是否写过日志
+    bool consume();
+
+private:
+    struct Item
+    {
+        LogContextPtr ctx;
+        const Logger *logger = nullptr;
+        uint64_t enqueue_ns = 0;
+    };
+
+    std::vector<std::shared_ptr<LogChannel>> _channels;
+    MPSCQueue<Item> _queue;
+    std::thread _thread;
+    semphore _sem;
+    std::atomic<bool> _sleeping{false};
+    std::atomic<bool> _exit{false};
+    std::atomic<uint64_t> _written{0};
+    std::atomic<uint64_t> _dropped{0};
+    std::atomic<uint64_t> _max_lag_ns{0};
+    std::atomic<uint64_t> _total_lag_ns{0};
+};
+
 class Logger : public std::enable_shared_from_this<Logger>, public noncopyable
 {
 public:
@@ -218,25 +1041,223 @@ public:
 
     void set_writer(const std::shared_ptr<LogWriter> &writer);
     void setLevel(const LogLevel level);
+
+    /**
+     * 设置日志时间中秒的小数位数
+     * @param precision 0~6，默认3(毫秒)，6为微秒
+     */
+    void setTimePrecision(int precision);
+    int getTimePrecision() const;
+
+    /**
+     * 开启延迟格式化，调用线程只拷贝参数的原始字节，转换为文本的工作交给写线程
+     * 配合LogAsyncWriter使用可降低调用线程的开销
+     */
+    void setDeferredFormat(bool enable);
+    bool deferredFormat() const;
+
+    /**
+     * 设置单条日志内容的最大字节数，超出部分被截断并在日志末尾注明，0表示不限制
+     * 默认1MB
+     */
+    void setMaxRecordSize(size_t bytes);
+    size_t maxRecordSize() const;
+
+    /**
+     * 设置重复日志的合并窗口，同一位置内容相同的日志在窗口内只打印一次，之后附带重复次数打印
+     * @param ms 毫秒，默认500，0表示不合并
+     */
+    void setRepeatWindow(size_t ms);
+
+    /**
+     * 设置飞行记录器，日志在进入写线程队列之前由调用线程写入记录器
+     * 应在开始打印日志前设置
+     */
+    void setFlightRecorder(const std::shared_ptr<LogFlightRecorder> &recorder);
+    const std::shared_ptr<LogFlightRecorder> &getFlightRecorder() const;
     const std::string &getName() const;
 
+    /**
+     * 该等级的日志是否可能被某个通道输出，用于在构造日志前快速过滤
+     */
+    bool enabled(LogLevel level) const
+    {
+        return level >= _min_level.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * 调用位置的日志是否需要构造，线程覆盖的等级及按文件或flag配置的等级作为该位置的门槛
+     * 放行的日志仍按各通道的等级过滤，低于所有通道等级的日志不会构造
+     */
+    bool enabled(const LogCallSite &site, LogLevel level) const
+    {
+        auto override_level = overrideLevel(site);
+        return enabled(level) && (override_level == LOG_LEVEL_UNSET || level >= override_level);
+    }
+
+    /**
+     * 按源文件或flag设置日志等级，可在运行时随时修改，对所有Logger生效
+     * 规则只决定调用位置是否产生日志，各通道仍按自身等级过滤，因此可以只让文件通道收到某个模块的调试日志:
+     * 文件通道设为LTrace、控制台通道设为LWarn，再配置"db=trace,*=info"
+     * flag由WriteL_FLAG等宏指定，没有flag的调用位置只按文件名匹配
+     * @param spec 逗号分隔的"模式=等级"，如"net*=trace,db.cpp=debug,noisy=error"
+     *             模式支持*和?通配，匹配文件名、不含扩展名的文件名或调用位置的flag，靠前的规则优先
+     *             等级为trace/debug/info/warn/error或0~4
+     * @return 格式错误时返回false且不修改配置
+     */
+    static bool setModuleLevels(const std::string &spec);
+
+    /**
+     * 添加或替换一条按文件或flag设置日志等级的规则
+     */
+    static void setModuleLevel(const std::string &pattern, LogLevel level);
+
+    /**
+     * 清除所有按文件或flag设置的日志等级
+     */
+    static void clearModuleLevels();
+
     void write(const LogContextPtr &logContext);
+    // 通知所有通道写出缓冲的日志
+    void flushChannels();
 
 private:
+    friend class LogChannel;
     void write_channels(const LogContextPtr &logContext);
     void writeChannels_l(const LogContextPtr &logContext);
+    using ChannelList = std::vector<std::shared_ptr<LogChannel>>;
+    // 写日志的线程读取通道列表快照，稳态下只有一次原子读，列表变化后才加锁更新快照
+    const ChannelList &channels_l();
+    // 发布新的通道列表，须持有_channel_mtx
+    void publishChannels(ChannelList channels);
+    // 输出被合并的重复次数，force为false时只输出已超出合并窗口的
+    void flushRepeats(const struct timeval &now, bool force);
+    // 距最早的重复次数到期的毫秒数，没有待输出的重复次数时返回-1
+    int64_t repeatFlushDelay() const;
+    // 同步模式下的定时线程，没有后续日志时也按时输出到期的重复次数
+    void runRepeatTimer();
+    // 根据所有通道重新计算最低日志等级
+    void updateLevel();
 
 private:
-    LogContextPtr _last_log;
+    // 所有通道及飞行记录器中的最低日志等级，没有通道时大于LError
+    std::atomic<int> _min_level;
+    // 所有通道中的最低日志等级，低于该等级的日志只写入飞行记录器
+    std::atomic<int> _channel_level;
+    // 重复日志表，按调用位置与内容的哈希直接映射，不同位置交替出现的重复日志也能合并
+    struct RepeatEntry
+    {
+        uint64_t site = 0;
+        uint64_t content = 0;
+        // 最近打印的一条
+        LogContextPtr ctx;
+        // 合并窗口的起始时间
+        struct timeval tv;
+        // 之后被合并的次数
+        int repeat = 0;
+    };
+    static const size_t s_repeat_table_size = 64;
+    RepeatEntry _repeat_table[s_repeat_table_size];
+    std::atomic<int64_t> _repeat_window_ms{500};
+    // 有未输出重复次数的条目数
+    size_t _repeat_pending = 0;
+    // 不晚于这些条目中最早的窗口起始时间，窗口到期前flushRepeats不扫描整表
+    struct timeval _repeat_earliest = {0, 0};
     std::string _logger_name;
+    int _time_precision = 3;
+    bool _deferred_format = false;
+    size_t _max_record_size = 1024 * 1024;
     std::shared_ptr<LogWriter> _writer;
-    std::map<std::string, std::shared_ptr<LogChannel>> _channels;
+    std::shared_ptr<LogFlightRecorder> _recorder;
+    // 同步模式(没有设置writer)下串行化通道写入
+    std::mutex _sync_mtx;
+    // 同步模式下首次出现重复日志时启动的定时线程，与条件变量均由_sync_mtx保护
+    std::thread _repeat_timer;
+    std::condition_variable _repeat_cond;
+    bool _repeat_timer_exit = false;
+    // 通道列表写时复制，修改时发布新的不可变列表，正在使用旧列表的线程不受影响
+    std::mutex _channel_mtx;
+    std::shared_ptr<const ChannelList> _channels;
+    std::atomic<uint64_t> _channels_version{0};
+    // 写日志的线程持有的快照，与重复日志表一样只由写线程或持有_sync_mtx的线程访问
+    std::shared_ptr<const ChannelList> _channels_snapshot;
+    uint64_t _snapshot_version = 0;
 };
 
-extern Logger *g_defaultLogger;
-#define WriteL(level) LogCapturer(getLogger(), level, __FILE__, __FUNCTION__, __LINE__)
+extern std::atomic<Logger *> g_defaultLogger;
+
+inline Logger &getLogger()
+{
+    auto logger = g_defaultLogger.load(std::memory_order_acquire);
+    if (!logger)
+    {
+        Logger *expected = nullptr;
+        logger = &Logger::Instance();
+        if (!g_defaultLogger.compare_exchange_strong(expected, logger, std::memory_order_acq_rel))
+        {
+            // 其他线程已调用setLogger
+            logger = expected;
+        }
+    }
+    return *logger;
+}
+
+// 日志等级不满足时不会构造LogContext，也不会对<<右侧的参数求值
+#define WriteL(level) \
+    if (static constexpr auto s_log_site = LOG_CALL_SITE(""); !getLogger().enabled(s_log_site, level)) {} else LogCapturer(getLogger(), s_log_site, level)
 #define TraceL WriteL(LTrace)
 #define DebugL WriteL(LDebug)
 #define InfoL WriteL(LInfo)
 #define WarnL WriteL(LWarn)
-#define ErrorL WriteL(LError)
\ No newline at end of file
+#define ErrorL WriteL(LError)
+
+// 带flag的日志，flag须为字符串常量，输出时代替日志器名称，并可被Logger::setModuleLevels按模块匹配
+#define WriteL_FLAG(level, flag) \
+    if (static constexpr auto s_log_site = LOG_CALL_SITE(flag); !getLogger().enabled(s_log_site, level)) {} else LogCapturer(getLogger(), s_log_site, level)
+#define TraceL_FLAG(flag) WriteL_FLAG(LTrace, flag)
+#define DebugL_FLAG(flag) WriteL_FLAG(LDebug, flag)
+#define InfoL_FLAG(flag) WriteL_FLAG(LInfo, flag)
+#define WarnL_FLAG(flag) WriteL_FLAG(LWarn, flag)
+#define ErrorL_FLAG(flag) WriteL_FLAG(LError, flag)
+
+// 按调用位置限频，cond为LogSiteLimiter的判断方法，输出的日志附带被抑制的次数
+#define WriteL_IF(level, cond)                                                                              \
+    if (static constexpr auto s_log_site = LOG_CALL_SITE(""); !getLogger().enabled(s_log_site, level)) {}    \
+    else if (static LogSiteLimiter s_log_limiter; !s_log_limiter.cond) {}                                  \
+    else LogCapturer(getLogger(), s_log_site, level).suppressed(s_log_limiter.takeSuppressed())
+// 每n次打印一次
+#define WriteL_EVERY_N(level, n) WriteL_IF(level, everyN(n))
+// 每ms毫秒最多打印一次
+#define WriteL_EVERY_MS(level, ms) WriteL_IF(level, everyMs(ms))
+// 只打印前n次
+#define WriteL_FIRST_N(level, n) WriteL_IF(level, firstN(n))
+// 按概率rate(0~1)采样打印
+#define WriteL_SAMPLE(level, rate) WriteL_IF(level, sample(rate))
+
+#define TraceL_EVERY_N(n) WriteL_EVERY_N(LTrace, n)
+#define DebugL_EVERY_N(n) WriteL_EVERY_N(LDebug, n)
+#define InfoL_EVERY_N(n) WriteL_EVERY_N(LInfo, n)
+#define WarnL_EVERY_N(n) WriteL_EVERY_N(LWarn, n)
+#define ErrorL_EVERY_N(n) WriteL_EVERY_N(LError, n)
+
+#define TraceL_EVERY_MS(ms) WriteL_EVERY_MS(LTrace, ms)
+#define DebugL_EVERY_MS(ms) WriteL_EVERY_MS(LDebug, ms)
+#define InfoL_EVERY_MS(ms) WriteL_EVERY_MS(LInfo, ms)
+#define WarnL_EVERY_MS(ms) WriteL_EVERY_MS(LWarn, ms)
+#define ErrorL_EVERY_MS(ms) WriteL_EVERY_MS(LError, ms)
+
+#define TraceL_FIRST_N(n) WriteL_FIRST_N(LTrace, n)
+#define DebugL_FIRST_N(n) WriteL_FIRST_N(LDebug, n)
+#define InfoL_FIRST_N(n) WriteL_FIRST_N(LInfo, n)
+#define WarnL_FIRST_N(n) WriteL_FIRST_N(LWarn, n)
+#define ErrorL_FIRST_N(n) WriteL_FIRST_N(LError, n)
+
+#define TraceL_SAMPLE(rate) WriteL_SAMPLE(LTrace, rate)
+#define DebugL_SAMPLE(rate) WriteL_SAMPLE(LDebug, rate)
+#define InfoL_SAMPLE(rate) WriteL_SAMPLE(LInfo, rate)
+#define WarnL_SAMPLE(rate) WriteL_SAMPLE(LWarn, rate)
+#define ErrorL_SAMPLE(rate) WriteL_SAMPLE(LError, rate)
+
+#include "logFormat.h"
+
+#endif
@@ -0,0 +1,191 @@
+#ifndef MPSC_QUEUE_H
+#define MPSC_QUEUE_H
+
+#include <atomic>
+#include <memory>
+#include <cstddef>
+#include <cstdint>
+#include "tools.h"
+
+#ifndef CACHE_LINE_SIZE
+#define CACHE_LINE_SIZE 64
+#endif
+
+/**
+ * 有界无锁多生产者单消费者环形队列
+ * 所有槽位在构造时一次性分配，入队只需一次原子抢占，不会再分配内存
+ * 每个槽位独占一个缓存行，避免生产者之间的伪共享
+ * 出队同样通过原子抢占，生产者可在队列满时调用tryPop丢弃最早的元素
+ */
+template <typename T>
+class MPSCQueue : public noncopyable
+{
+public:
+    /**
+     * @param capacity 队列容量，会向上取整为2的幂
+     */
+    explicit MPSCQueue(size_t capacity)
+    {
+        size_t size = 2;
+        while (size < capacity)
+        {
+            size <<= 1;
+        }
+        _mask = size - 1;
+        _cells.reset(new Cell[size]);
+        for (size_t i = 0; i < size; ++i)
+        {
+            _cells[i].seq.store(i, std::memory_order_relaxed);
+        }
+        _head.store(0, std::memory_order_relaxed);
+        _tail.store(0, std::memory_order_relaxed);
+    }
+
+    /**
+     * 入队，可在任意线程调用
+     * @return 队列已满时返回false，data不会被移动
+     */
+    template <typename U>
+    bool tryPush(U &&data)
+    {
+        Cell *cell;
+        size_t pos = _head.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            cell = &_cells[pos & _mask];
+            size_t seq = cell->seq.load(std::memory_order_acquire);
+            intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+            if (dif == 0)
+            {
+                if (_head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    break;
+                }
+            }
+            else if (dif < 0)
+            {
+                // 队列已满
+                return false;
+            }
+            else
+            {
+                pos = _head.load(std::memory_order_relaxed);
+            }
+        }
+        cell->data = std::forward<U>(data);
+        cell->seq.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * 出队，可在任意线程调用
+     */
+    bool tryPop(T &data)
+    {
+        Cell *cell;
+        size_t pos = _tail.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            cell = &_cells[pos & _mask];
+            size_t seq = cell->seq.load(std::memory_order_acquire);
+            intptr_t dif = (intptr_t)seq - (intptr_t)(pos + 1);
+            if (dif == 0)
+            {
+                if (_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    break;
+                }
+            }
+            else if (dif < 0)
+            {
+                // 队列为空，或最早的元素尚未写完
+                return false;
+            }
+            else
+            {
+                pos = _tail.load(std::memory_order_relaxed);
+            }
+        }
+        data = std::move(cell->data);
+        cell->seq.store(pos + _mask + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * 批量出队，只能在消费者线程调用，可与其他线程的tryPop并发
+     * 先一次抢占连续的已写完元素，元素在回调返回后才归还给生产者
+     * @param cb 回调，参数为出队元素的引用
+     * @param max_count 本批次最多出队个数
+     * @return 实际出队个数
+     */
+    template <typename FUNC>
+    size_t popBatch(FUNC &&cb, size_t max_count)
+    {
+        size_t pos = _tail.load(std::memory_order_relaxed);
+        size_t count;
+        for (;;)
+        {
+            count = 0;
+            while (count < max_count && _cells[(pos + count) & _mask].seq.load(std::memory_order_acquire) == pos + count + 1)
+            {
+                ++count;
+            }
+            if (!count)
+            {
+                return 0;
+            }
+            // 失败说明最早的元素被其他线程取走，pos已更新为新的位置
+            if (_tail.compare_exchange_weak(pos, pos + count, std::memory_order_relaxed))
+            {
+                break;
+            }
+        }
+        for (size_t i = 0; i < count; ++i)
+        {
+            Cell &cell = _cells[(pos + i) & _mask];
+            cb(cell.data);
+            cell.data = T();
+            cell.seq.store(pos + i + _mask + 1, std::memory_order_release);
+        }
+        return count;
+    }
+
+    /**
+     * 队列是否为空，只能在消费者线程调用
+     */
+    bool empty() const
+    {
+        size_t pos = _tail.load(std::memory_order_relaxed);
+        return _cells[pos & _mask].seq.load(std::memory_order_acquire) != pos + 1;
+    }
+
+    /**
+     * 队列中元素个数的近似值，可在任意线程调用
+     */
+    size_t size() const
+    {
+        size_t head = _head.load(std::memory_order_relaxed);
+        size_t tail = _tail.load(std::memory_order_relaxed);
+        return head > tail ? head - tail : 0;
+    }
+
+    size_t capacity() const
+    {
+        return _mask + 1;
+    }
+
+private:
+    struct alignas(CACHE_LINE_SIZE) Cell
+    {
+        std::atomic<size_t> seq;
+        T data;
+    };
+
+    size_t _mask;
+    std::unique_ptr<Cell[]> _cells;
+    // 生产者与消费者的游标分处不同缓存行
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> _head;
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> _tail;
+};
+
+#endif
@@ -0,0 +1,86 @@
+#include <cstdio>
+#include <mutex>
+#include <vector>
+#include <unistd.h>
+#include "logger.h"
+
+/**
+ * 重复日志合并: 一串相同日志之后没有任何新日志，重复次数也应在合并窗口到期后输出
+ * 用法: ./bin/repeat_test，全部通过时返回0
+ */
+
+// 记录收到的每条日志及其重复次数
+class CollectChannel : public LogChannel
+{
+public:
+    CollectChannel() : LogChannel("CollectChannel", LTrace) {}
+
+    void write(const Logger &, const LogContextPtr &ctx) override
+    {
+        std::lock_guard<std::mutex> lck(_mtx);
+        _repeats.emplace_back(ctx->_repeat);
+    }
+
+    // 收到的日志条数与其中带重复次数的条数
+    void count(size_t &records, int &repeated)
+    {
+        std::lock_guard<std::mutex> lck(_mtx);
+        records = _repeats.size();
+        repeated = 0;
+        for (auto repeat : _repeats)
+        {
+            repeated += repeat;
+        }
+    }
+
+private:
+    std::mutex _mtx;
+    std::vector<int> _repeats;
+};
+
+static int s_failed = 0;
+
+static void check(bool cond, const char *what)
+{
+    printf("%s %s\n", cond ? "[ OK ]" : "[FAIL]", what);
+    if (!cond)
+    {
+        ++s_failed;
+    }
+}
+
+static void runCase(const char *name, bool async)
+{
+    static constexpr auto s_site = LOG_CALL_SITE("");
+    static const size_t s_window_ms = 100;
+    Logger logger(name);
+    auto channel = std::make_shared<CollectChannel>();
+    logger.add_channel(channel);
+    logger.setRepeatWindow(s_window_ms);
+    if (async)
+    {
+        logger.set_writer(std::make_shared<LogAsyncWriter>());
+    }
+    for (int i = 0; i < 5; ++i)
+    {
+        LogCapturer(logger, s_site, LInfo) << "same message";
+    }
+
+    // 之后不再打印日志，等待窗口到期并留出调度余量
+    size_t records = 0;
+    int repeated = 0;
+    for (int i = 0; i < 30 && repeated < 4; ++i)
+    {
+        usleep(s_window_ms * 1000 / 5);
+        channel->count(records, repeated);
+    }
+    std::string what = std::string(name) + ": repeat summary written without a following record";
+    check(records == 2 && repeated == 4, what.data());
+}
+
+int main()
+{
+    runCase("sync", false);
+    runCase("async", true);
+    return s_failed ? 1 : 0;
+}
@@ -0,0 +1,29 @@
+#include <cstdio>
+#include <cstdlib>
+#include "logRecorder.h"
+
+/**
+ * 读取飞行记录器文件中最近的日志，用于进程崩溃后的排查
+ * 用法: ./bin/flight_recover <记录文件> [条数]
+ */
+int main(int argc, char *argv[])
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "usage: %s <flight file> [count]\n", argv[0]);
+        return 1;
+    }
+    local_time_init();
+    size_t count = argc > 2 ? strtoul(argv[2], nullptr, 10) : SIZE_MAX;
+    auto records = LogFlightRecorder::recover(argv[1], count);
+    if (records.empty())
+    {
+        fprintf(stderr, "no records in %s\n", argv[1]);
+        return 1;
+    }
+    for (auto &record : records)
+    {
+        printf("%s\n", record.data());
+    }
+    return 0;
+}
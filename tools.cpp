@@ -1,11 +1,11 @@
 #include "tools.h"
 #include <cstring>
-static int _daylight_active;
-static long _current_timezone;
-int get_daylight_active()
-{
-    return _daylight_active;
-}
+#include <set>
+#if defined(__linux__)
+#include <sys/syscall.h>
+#endif
+#include <atomic>
+#include <algorithm>
 
 static int is_leap_year(time_t year)
 {
@@ -19,6 +19,27 @@ static int is_leap_year(time_t year)
         return 1; /* If div by 100 and 400 is leap. */
 }
 
+/**
+ * 时区规则表，记录[begin, end)范围内每段本地时间偏移
+ * 由local_time_init根据系统时区数据预先计算，构建完成后只读
+ */
+struct TzRule
+{
+    time_t start;     // 该规则生效的UTC时间
+    long gmtoff;      // 本地时间与UTC的偏移(秒)
+    int isdst;        // 是否夏令时
+    const char *zone; // 时区缩写
+};
+
+struct TzTable
+{
+    time_t begin;
+    time_t end;
+    std::vector<TzRule> rules;
+};
+
+// 时区表构建后不再修改，替换时旧表不释放，保证并发读取无锁且安全
+static std::atomic<const TzTable *> s_tz_table(nullptr);
 semphore::semphore(int count)
 {
     _count = count;
@@ -52,6 +73,66 @@ void semphore::wait()
     --_count;
 }
 
+bool semphore::waitFor(int64_t ms)
+{
+    std::unique_lock<std::recursive_mutex> lock(_mutex);
+    if (!_cond.wait_for(lock, std::chrono::milliseconds(ms), [this]()
+                        { return _count != 0; }))
+    {
+        return false;
+    }
+    --_count;
+    return true;
+}
+
+TaskQueueThread::TaskQueueThread(const char *name) : _name(name)
+{
+    _thread = std::thread(&TaskQueueThread::run, this);
+}
+
+TaskQueueThread::~TaskQueueThread()
+{
+    {
+        std::lock_guard<std::mutex> lck(_mtx);
+        _exit = true;
+    }
+    _cond.notify_one();
+    _thread.join();
+}
+
+void TaskQueueThread::post(std::function<void()> task)
+{
+    {
+        std::lock_guard<std::mutex> lck(_mtx);
+        _tasks.emplace_back(std::move(task));
+    }
+    _cond.notify_one();
+}
+
+void TaskQueueThread::run()
+{
+    setThreadName(_name.data());
+    std::vector<std::function<void()>> tasks;
+    for (;;)
+    {
+        {
+            std::unique_lock<std::mutex> lck(_mtx);
+            _cond.wait(lck, [this]()
+                       { return _exit || !_tasks.empty(); });
+            if (_tasks.empty())
+            {
+                return;
+            }
+            tasks.swap(_tasks);
+        }
+        for (auto &task : tasks)
+        {
+            task();
+        }
+        tasks.clear();
+    }
+}
+
 std::string exeDir(bool isExe /*= true*/)
 {
     auto path = exePath(isExe);
@@ -162,55 +243,110 @@ const char *getFileName(const char *file)
     return pos ? pos + 1 : file;
 }
 
-// 获取系统时区配置
-void local_time_init()
+#if !defined(_WIN32)
+static TzRule makeTzRule(time_t t)
 {
-    /* Obtain timezone and daylight info. */
-    tzset(); /* Now 'timezome' global is populated. */
-#if defined(__linux__) || defined(__sun)
-    _current_timezone = timezone;
-#elif defined(_WIN32)
-    time_t time_utc;
-    struct tm tm_local;
-
-    // Get the UTC time
-    time(&time_utc);
-
-    // Get the local time
-    // Use localtime_r for threads safe for linux
-    // localtime_r(&time_utc, &tm_local);
-    localtime_s(&tm_local, &time_utc);
-
-    time_t time_local;
-    struct tm tm_gmt;
+    struct tm tm;
+    localtime_r(&t, &tm);
+    return TzRule{t, tm.tm_gmtoff, tm.tm_isdst, tm.tm_zone};
+}
 
-    // Change tm to time_t
-    time_local = mktime(&tm_local);
+// 二分查找(lo, hi]内时区偏移发生变化的时刻，要求lo与hi的偏移不同
+static time_t findTzTransition(time_t lo, time_t hi, long lo_gmtoff, int lo_isdst)
+{
+    while (hi - lo > 1)
+    {
+        time_t mid = lo + (hi - lo) / 2;
+        auto rule = makeTzRule(mid);
+        if (rule.gmtoff == lo_gmtoff && rule.isdst == lo_isdst)
+        {
+            lo = mid;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+    return hi;
+}
 
-    // Change it to GMT tm
-    // gmtime_r(&time_utc, &tm_gmt);//linux
-    gmtime_s(&tm_gmt, &time_utc);
+static const TzTable *buildTzTable(time_t now)
+{
+    const time_t secs_day = 3600 * 24;
+    auto table = new TzTable;
+    // 覆盖过去2年至未来8年，范围之外回退至localtime_r
+    table->begin = now - 2 * 366 * secs_day;
+    table->end = now + 8 * 366 * secs_day;
+    table->rules.emplace_back(makeTzRule(table->begin));
+    // 按天采样，在偏移变化的一天内二分出精确的切换时刻
+    for (time_t t = table->begin + secs_day; t < table->end + secs_day; t += secs_day)
+    {
+        auto &last = table->rules.back();
+        auto rule = makeTzRule(t);
+        if (rule.gmtoff != last.gmtoff || rule.isdst != last.isdst)
+        {
+            table->rules.emplace_back(makeTzRule(findTzTransition(t - secs_day, t, last.gmtoff, last.isdst)));
+        }
+    }
+    return table;
+}
 
-    int time_zone = tm_local.tm_hour - tm_gmt.tm_hour;
-    if (time_zone < -12)
+static const TzRule *findTzRule(const TzTable *table, time_t t)
+{
+    if (!table || t < table->begin || t >= table->end)
     {
-        time_zone += 24;
+        return nullptr;
     }
-    else if (time_zone > 12)
+    // 日志时间基本单调，先检查本线程上次命中的规则
+    static thread_local size_t s_hint = 0;
+    auto &rules = table->rules;
+    if (s_hint < rules.size() && rules[s_hint].start <= t && (s_hint + 1 == rules.size() || t < rules[s_hint + 1].start))
     {
-        time_zone -= 24;
+        return &rules[s_hint];
     }
+    auto it = std::upper_bound(rules.begin(), rules.end(), t, [](time_t t, const TzRule &rule)
+                               { return t < rule.start; });
+    s_hint = it - rules.begin() - 1;
+    return &rules[s_hint];
+}
+#endif
+
+// 获取系统时区配置
+void local_time_init()
+{
+    /* Obtain timezone and daylight info. */
+    tzset();
+#if !defined(_WIN32)
+    s_tz_table.store(buildTzTable(time(nullptr)), std::memory_order_release);
+#endif
+}
 
-    _current_timezone = time_zone;
+long getGMTOff(time_t t)
+{
+#if !defined(_WIN32)
+    auto rule = findTzRule(s_tz_table.load(std::memory_order_acquire), t);
+    if (rule)
+    {
+        return rule->gmtoff;
+    }
+    return makeTzRule(t).gmtoff;
 #else
-    struct timeval tv;
-    struct timezone tz;
-    gettimeofday(&tv, &tz);
-    _current_timezone = tz.tz_minuteswest * 60L;
+    return getGMTOff();
 #endif
-    time_t t = time(NULL);
-    struct tm *aux = localtime(&t);
-    _daylight_active = aux->tm_isdst;
+}
+
+// 由1970-01-01起的天数计算公历日期，见 http://howardhinnant.github.io/date_algorithms.html
+static void civil_from_days(int64_t z, int64_t &year, int &month, int &day)
+{
+    z += 719468;
+    const int64_t era = (z >= 0 ? z : z - 146096) / 146097;
+    const unsigned doe = (unsigned)(z - era * 146097);                     // [0, 146096]
+    const unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365; // [0, 399]
+    const unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);             // [0, 365]
+    const unsigned mp = (5 * doy + 2) / 153;                                // [0, 11]
+    day = doy - (153 * mp + 2) / 5 + 1;                                     // [1, 31]
+    month = mp < 10 ? mp + 3 : mp - 9;                                      // [1, 12]
+    year = (int64_t)yoe + era * 400 + (month <= 2);
 }
 
 // 获取时间戳对应的本地时间
@@ -220,51 +356,48 @@ void no_locks_localtime(struct tm *tmp, time_t t)
     const time_t secs_hour = 3600;
     const time_t secs_day = 3600 * 24;
 
-    t -= _current_timezone;            /* Adjust for timezone. */
-    t += 3600 * get_daylight_active(); /* Adjust for daylight time. */
-    time_t days = t / secs_day;        /* Days passed since epoch. */
-    time_t seconds = t % secs_day;     /* Remaining seconds. */
+#if !defined(_WIN32)
+    auto rule = findTzRule(s_tz_table.load(std::memory_order_acquire), t);
+    if (!rule)
+    {
+        // 超出预计算范围，交由系统处理
+        localtime_r(&t, tmp);
+        return;
+    }
+    tmp->tm_isdst = rule->isdst;
+    tmp->tm_gmtoff = rule->gmtoff;
+    tmp->tm_zone = rule->zone;
+    t += rule->gmtoff;
+#else
+    localtime_s(tmp, &t);
+    return;
+#endif
+
+    time_t days = t / secs_day;    /* Days passed since epoch. */
+    time_t seconds = t % secs_day; /* Remaining seconds. */
+    if (seconds < 0)
+    {
+        seconds += secs_day;
+        --days;
+    }
 
-    tmp->tm_isdst = get_daylight_active();
     tmp->tm_hour = seconds / secs_hour;
     tmp->tm_min = (seconds % secs_hour) / secs_min;
     tmp->tm_sec = (seconds % secs_hour) % secs_min;
-#ifndef _WIN32
-    tmp->tm_gmtoff = -_current_timezone;
-#endif
     /* 1/1/1970 was a Thursday, that is, day 4 from the POV of the tm structure
      * where sunday = 0, so to calculate the day of the week we have to add 4
      * and take the modulo by 7. */
-    tmp->tm_wday = (days + 4) % 7;
+    tmp->tm_wday = ((days + 4) % 7 + 7) % 7;
 
-    /* Calculate the current year. */
-    tmp->tm_year = 1970;
-    while (1)
-    {
-        /* Leap years have one day more. */
-        time_t days_this_year = 365 + is_leap_year(tmp->tm_year);
-        if (days_this_year > days)
-            break;
-        days -= days_this_year;
-        tmp->tm_year++;
-    }
-    tmp->tm_yday = days; /* Number of day of the current year. */
-
-    /* We need to calculate in which month and day of the month we are. To do
-     * so we need to skip days according to how many days there are in each
-     * month, and adjust for the leap year that has one more day in February. */
-    int mdays[12] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
-    mdays[1] += is_leap_year(tmp->tm_year);
+    int64_t year;
+    int month, day;
+    civil_from_days(days, year, month, day);
 
-    tmp->tm_mon = 0;
-    while (days >= mdays[tmp->tm_mon])
-    {
-        days -= mdays[tmp->tm_mon];
-        tmp->tm_mon++;
-    }
-
-    tmp->tm_mday = days + 1; /* Add 1 since our 'days' is zero-based. */
-    tmp->tm_year -= 1900;    /* Surprisingly tm_year is year-1900. */
+    static const int s_days_before_month[12] = {0, 31, 59, 90, 120, 151, 181, 212, 243, 273, 304, 334};
+    tmp->tm_yday = s_days_before_month[month - 1] + day - 1 + (month > 2 ? is_leap_year(year) : 0);
+    tmp->tm_mon = month - 1;
+    tmp->tm_mday = day;
+    tmp->tm_year = year - 1900; /* Surprisingly tm_year is year-1900. */
 }
 
 void scanDir(const std::string path, const std::function<bool(const std::string &path, bool isDir)> &cb, bool enter_subdir)
@@ -432,3 +565,61 @@ std::string getThreadName()
     return ss.str();
 #endif
 }
+
+static uint64_t getThreadId()
+{
+#if defined(__linux__)
+    return (uint64_t)syscall(SYS_gettid);
+#elif defined(__MACH__) || defined(__APPLE__)
+    uint64_t tid = 0;
+    pthread_threadid_np(nullptr, &tid);
+    return tid;
+#elif defined(_WIN32)
+    return (uint64_t)GetCurrentThreadId();
+#else
+    return (uint64_t)std::hash<std::thread::id>()(std::this_thread::get_id());
+#endif
+}
+
+// 驻留线程名，相同线程名只保存一份且永不释放，日志可以安全地持有其指针
+static const char *internThreadName(const std::string &name)
+{
+    static std::mutex s_mtx;
+    static auto s_names = new std::set<std::string>;
+    std::lock_guard<std::mutex> lck(s_mtx);
+    return s_names->emplace(name).first->c_str();
+}
+
+static ThreadInfo &threadInfoCache()
+{
+    static thread_local ThreadInfo s_info{nullptr, 0};
+    return s_info;
+}
+
+const ThreadInfo &getThreadInfo()
+{
+    auto &info = threadInfoCache();
+    if (!info.name)
+    {
+        info.tid = getThreadId();
+        info.name = internThreadName(getThreadName());
+    }
+    return info;
+}
+
+void setThreadName(const char *name)
+{
+#if defined(__linux__) && !defined(ANDROID)
+    char buf[16] = {0};
+    strncpy(buf, name, sizeof(buf) - 1);
+    pthread_setname_np(pthread_self(), buf);
+#elif defined(__MACH__) || defined(__APPLE__)
+    pthread_setname_np(name);
+#endif
+    auto &info = threadInfoCache();
+    if (!info.tid)
+    {
+        info.tid = getThreadId();
+    }
+    info.name = internThreadName(name);
+}
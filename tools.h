@@ -4,8 +4,11 @@
 #include <mutex>
 #include <condition_variable>
 #include <functional>
+#include <thread>
 #include "onceToken.h"
 #include <vector>
+#include <string>
+#include <cstdint>
 #if defined(_WIN32)
 #include <windows.h>
 
@@ -40,8 +43,9 @@ bool is_dir(const char *path);
 const char *getFileName(const char *file);
 void scanDir(const std::string path, const std::function<bool(const std::string &path, bool isDir)> &cb, bool enter_subdir = false);
 
+// 加载系统时区，预先计算前后数年内的时区切换表
 void local_time_init();
-// 无锁 考虑时区 夏令时的时间  线程安全
+// 无锁 考虑时区 夏令时的时间  线程安全，时区切换表范围内为O(1)
 void no_locks_localtime(struct tm *tmp, time_t t);
 std::string getTimeStr(const char *fmt, time_t time = 0);
 struct tm getLocalTime(time_t sec);
@@ -50,9 +54,39 @@ bool end_with(const std::string &str, const std::string &substr);
 bool start_with(const std::string &str, const std::string &substr);
 
 std::string getThreadName();
+
+/**
+ * 当前线程的线程名与线程id
+ * 首次使用时获取并缓存于thread_local，之后仅在setThreadName时刷新
+ * name指向进程内驻留的字符串，线程退出后依然有效
+ */
+struct ThreadInfo
+{
+    const char *name;
+    uint64_t tid;
+};
+const ThreadInfo &getThreadInfo();
+
+/**
+ * 设置当前线程名，并刷新线程名缓存
+ * @param name 线程名，系统线程名最多保留15个字符，日志中保留完整名称
+ */
+void setThreadName(const char *name);
 long getGMTOff();
+// 指定时刻本地时间与UTC的偏移(秒)，正确处理夏令时切换
+long getGMTOff(time_t t);
 std::vector<std::string> split(const std::string &s, const char *delim);
 
+// FNV-1a 64位哈希，可在编译期使用
+constexpr uint64_t fnv1a(const char *data, size_t size, uint64_t hash = 14695981039346656037ULL)
+{
+    for (size_t i = 0; i < size; ++i)
+    {
+        hash = (hash ^ (uint8_t)data[i]) * 1099511628211ULL;
+    }
+    return hash;
+}
+
 class semphore
 {
 public:
@@ -61,6 +95,8 @@ public:
 
     void post(int count = 1);
     void wait();
+    // 最多等待ms毫秒，超时返回false
+    bool waitFor(int64_t ms);
 
 private:
     int _count;
@@ -68,6 +104,30 @@ private:
     std::condition_variable_any _cond;
 };
 
+/**
+ * 后台任务线程，任务按提交顺序串行执行
+ */
+class TaskQueueThread
+{
+public:
+    explicit TaskQueueThread(const char *name);
+    // 执行完已提交的任务后退出
+    ~TaskQueueThread();
+
+    void post(std::function<void()> task);
+
+private:
+    void run();
+
+private:
+    bool _exit = false;
+    std::string _name;
+    std::mutex _mtx;
+    std::condition_variable _cond;
+    std::vector<std::function<void()>> _tasks;
+    std::thread _thread;
+};
+
 // 禁止拷贝基类
 class noncopyable
 {